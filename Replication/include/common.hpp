@@ -1,5 +1,7 @@
 #pragma once
 #include <string>
+#include <string_view>
+#include <algorithm>
 #include <vector>
 #include <mutex>
 #include <fstream>
@@ -15,6 +17,7 @@
 #include <fcntl.h>
 #include <sys/select.h>
 #include "../../btree/include/logger.hpp"
+#include "compression.hpp"
 
 using std::string;
 using std::vector;
@@ -45,7 +48,6 @@ namespace Consts {
     static constexpr int      SOCKET_TIMEOUT_MS = 5000;
     static constexpr int      LISTEN_BACKLOG    = 16;   // Default backlog for tcp_listen
     static constexpr int      NET_OPT_ENABLE    = 1;    // Value to enable socket options (setsockopt)
-    static constexpr size_t   RECV_CHUNK_SIZE   = 1;    // Bytes to read at a time in recv_line
     static constexpr int      BIND_READONLY_RETRIES = 35;
 
     static constexpr int      MAX_PORT_NUMBER = 65535;
@@ -266,27 +268,272 @@ static inline bool send_all(sock_t socketHandle, const string& data) {
   return true;
 }
 
-// Perskaito vieną tekstinę eilutę iš socket’o iki '\n' (be '\r\n'), patalpina į out.
-static inline bool recv_line(sock_t socketHandle, string& out) {
-  out.clear();
-  char ch;
-  while (true) {
-    ssize_t received = recv(socketHandle, &ch, 1, 0);
+// Buferizuotas skaitymas iš vieno socket'o: recv() kviečiamas READ_CHUNK_SIZE gabalais, eilutės ir kadrai
+// grąžinami kaip string_view į buferį (galioja iki kito skaitymo). Visi to ryšio skaitymai turi eiti per tą patį
+// SocketReader'į, nes buferyje gali likti kitos žinutės pradžia.
+class SocketReader {
+public:
+  static constexpr size_t READ_CHUNK_SIZE = 64UL * 1024UL;
+
+  explicit SocketReader(sock_t socketHandle = NET_INVALID) : socketHandle(socketHandle) {}
+
+  // Naujas ryšys: buferyje likę duomenys išmetami.
+  void Reset(sock_t newSocket) {
+    this->socketHandle = newSocket;
+    this->start = 0;
+    this->end = 0;
+    this->peerClosed = false;
+  }
+
+  sock_t Socket() const { return this->socketHandle; }
+
+  // true, jei paskutinis nepavykęs skaitymas buvo tvarkingas EOF (kita pusė uždarė ryšį), o ne timeout'as ar klaida.
+  bool PeerClosed() const { return this->peerClosed; }
+
+  // Eilutė iki '\n' (be '\n' ir galinio '\r').
+  bool ReadLine(std::string_view& line) {
+    size_t scanned = 0; // nuo start
+    while (true) {
+      const char* begin = this->buffer.data() + this->start;
+      const void* newline = std::memchr(begin + scanned, '\n', this->end - this->start - scanned);
+      if (newline != nullptr) {
+        size_t length = static_cast<const char*>(newline) - begin;
+        this->start += length + 1;
+        if (length > 0 && begin[length - 1] == '\r') {
+          length--;
+        }
+        line = std::string_view(begin, length);
+        return true;
+      }
+      scanned = this->end - this->start;
+      if (!this->Fill(scanned + 1)) {
+        return false;
+      }
+    }
+  }
+
+  bool ReadLine(string& out) {
+    std::string_view line;
+    if (!this->ReadLine(line)) {
+      return false;
+    }
+    out.assign(line.data(), line.size());
+    return true;
+  }
+
+  // Lygiai size baitų (pvz. kadro payload'as ar reikšmės likutis).
+  bool ReadExact(size_t size, std::string_view& out) {
+    while (this->end - this->start < size) {
+      if (!this->Fill(size)) {
+        return false;
+      }
+    }
+    out = std::string_view(this->buffer.data() + this->start, size);
+    this->start += size;
+    return true;
+  }
+
+  // Sekantis baitas jo nepašalinant.
+  bool Peek(char& out) {
+    if (this->start == this->end && !this->Fill(1)) {
+      return false;
+    }
+    out = this->buffer[this->start];
+    return true;
+  }
+
+private:
+  sock_t socketHandle;
+  string buffer;
+  size_t start{0}; // neperskaitytų duomenų pradžia
+  size_t end{0};   // gautų duomenų pabaiga
+  bool peerClosed{false};
+
+  // Vienas recv(). Neperskaityti duomenys perkeliami į buferio pradžią, buferis padidinamas iki needed baitų.
+  bool Fill(size_t needed) {
+    if (this->start > 0) {
+      std::memmove(&this->buffer[0], this->buffer.data() + this->start, this->end - this->start);
+      this->end -= this->start;
+      this->start = 0;
+    }
+    size_t capacity = std::max(needed, this->end + READ_CHUNK_SIZE);
+    if (this->buffer.size() < capacity) {
+      this->buffer.resize(capacity);
+    }
+    ssize_t received = recv(this->socketHandle, &this->buffer[this->end], this->buffer.size() - this->end, 0);
     if (received <= 0) {
       // Klaida ar nutrūkęs ryšys.
+      this->peerClosed = received == 0;
       return false;
     }
+    this->end += (size_t)received;
+    return true;
+  }
+};
+
+/* ===================== Binary replication protocol ===================== */
+
+// Leader <-> follower protokolas. HELLO visada tekstinis: "HELLO <nodeId> <lastAppliedLsn> [<version>]" - seni
+// leader'iai 4 žodžių HELLO atmeta, tada follower'is jungiasi iš naujo su tekstiniu HELLO. Jei abu palaiko
+// BINARY_VERSION, leader'is atsako HELLO kadru ir toliau siunčiami tik kadrai:
+//   header: version(1) | type(1) | count(4) | lsn(8) | payloadLength(4), little-endian
+//   RECORDS payload: count įrašų op(1) | lsn(8) | keyLength(2) | valueLength(4) | key | value
+// Kitaip (TEXT_VERSION) lieka eilutės WRITE/DELETE/RESET_WAL ir "ACK <lsn>".
+// SNAPSHOT_VERSION follower'is HELLO gale prideda savo lsnBase ("HELLO <nodeId> <lsn> 3 <lsnBase>"); kadrų formatas tas
+// pats, bet leader'is follower'iui, kurio istorijos WAL'e nebėra, gali atsiųsti puslapių snapshot'ą:
+//   SNAPSHOT_BEGIN (count = puslapių skaičius, lsn = snapshot LSN), SNAPSHOT_PAGES (count puslapių iš eilės nuo 0),
+//   SNAPSHOT_END (count, lsn kaip BEGIN). Po END follower'is ACK'ina snapshot LSN ir toliau gauna RECORDS.
+// COMPRESSION_VERSION ryšyje RECORDS ir SNAPSHOT_PAGES kadrai, kurių payload >= COMPRESSION_MIN_BYTES, siunčiami kaip
+// COMPRESSED, jei LZ blokas (compression.hpp) mažesnis: count/lsn - vidinio kadro,
+//   payload: innerType(1) | rawLength(4) | LZ blokas
+// Blokai sudaro vieną srautą per sesiją (LzStream): match'ai gali rodyti į ankstesnių COMPRESSED kadrų duomenis.
+namespace ReplProtocol {
+    static constexpr uint8_t  TEXT_VERSION          = 1;
+    static constexpr uint8_t  BINARY_VERSION        = 2;
+    static constexpr uint8_t  SNAPSHOT_VERSION      = 3;
+    static constexpr uint8_t  COMPRESSION_VERSION   = 4;
+    static constexpr size_t   FRAME_HEADER_SIZE     = 18;
+    static constexpr size_t   RECORD_HEADER_SIZE    = 15;
+    static constexpr size_t   COMPRESSED_HEADER_SIZE = 5;
+    static constexpr size_t   COMPRESSION_MIN_BYTES = 64;
+}
 
-    if (ch == '\n') {
-      break;      // eilutės pabaiga
-    }
-    if (ch != '\r') {
-      out.push_back(ch); // ignoruojam '\r'
+enum class ReplFrameType : uint8_t {
+    HELLO          = 1,  // leader -> follower: count = version, lsn = leader'io LSN
+    RECORDS        = 2,  // leader -> follower: count WRITE/DELETE įrašų
+    ACK            = 3,  // follower -> leader: lsn = kumuliatyvus ACK
+    RESET_WAL      = 4,  // leader -> follower (tik senesni leader'iai su stop-the-world COMPACT)
+    SNAPSHOT_BEGIN = 5,  // leader -> follower: count = puslapių skaičius, lsn = snapshot LSN
+    SNAPSHOT_PAGES = 6,  // leader -> follower: count puslapių (Page::PAGE_SIZE) iš eilės
+    SNAPSHOT_END   = 7,  // leader -> follower: count = puslapių skaičius, lsn = snapshot LSN
+    COMPRESSED     = 8,  // leader -> follower: suspaustas RECORDS / SNAPSHOT_PAGES kadras
+};
+
+struct ReplFrameHeader {
+    uint8_t       version{ReplProtocol::BINARY_VERSION};
+    ReplFrameType type{ReplFrameType::ACK};
+    uint32_t      count{0};
+    uint64_t      lsn{0};
+    uint32_t      payloadLength{0};
+};
+
+static inline void repl_put_le(string& out, uint64_t value, size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) {
+    out.push_back(static_cast<char>((value >> (8 * i)) & 0xFFU));
+  }
+}
+
+static inline uint64_t repl_get_le(const char* data, size_t bytes) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < bytes; i++) {
+    value |= static_cast<uint64_t>(static_cast<unsigned char>(data[i])) << (8 * i);
+  }
+  return value;
+}
+
+// Prideda kadro antraštę prie out (payload pridedamas atskirai).
+static inline void repl_append_frame_header(string& out, ReplFrameType type, uint32_t count, uint64_t lsn, uint32_t payloadLength) {
+  out.push_back(static_cast<char>(ReplProtocol::BINARY_VERSION));
+  out.push_back(static_cast<char>(type));
+  repl_put_le(out, count, 4);
+  repl_put_le(out, lsn, 8);
+  repl_put_le(out, payloadLength, 4);
+}
+
+// Prideda visą kadrą (antraštė + payload) prie out. Jei yra compressor (COMPRESSION_VERSION ryšys), didesnis payload
+// siunčiamas COMPRESSED kadru, kai tai sutaupo vietos.
+static inline void repl_append_frame(string& out, ReplFrameType type, uint32_t count, uint64_t lsn, std::string_view payload,
+                                     LzStream* compressor) {
+  if (compressor != nullptr && payload.size() >= ReplProtocol::COMPRESSION_MIN_BYTES) {
+    size_t headerOffset = out.size();
+    repl_append_frame_header(out, ReplFrameType::COMPRESSED, count, lsn, 0);
+    out.push_back(static_cast<char>(type));
+    repl_put_le(out, payload.size(), 4);
+    size_t blockOffset = out.size();
+    if (compressor->Compress(payload, out, payload.size() - ReplProtocol::COMPRESSED_HEADER_SIZE)) {
+      uint64_t payloadLength = ReplProtocol::COMPRESSED_HEADER_SIZE + (out.size() - blockOffset);
+      for (size_t i = 0; i < 4; i++) {
+        out[headerOffset + 14 + i] = static_cast<char>((payloadLength >> (8 * i)) & 0xFFU);
+      }
+      return;
     }
+    out.resize(headerOffset); // nesuspaudžiama - siunčiama kaip yra
   }
+  repl_append_frame_header(out, type, count, lsn, static_cast<uint32_t>(payload.size()));
+  out.append(payload.data(), payload.size());
+}
+
+// COMPRESSED kadrą išskleidžia: header.type tampa vidiniu tipu, payload - view į decompressor istoriją.
+static inline bool repl_decompress_frame(ReplFrameHeader& header, std::string_view& payload, LzStream& decompressor, size_t maxPayload) {
+  if (payload.size() < ReplProtocol::COMPRESSED_HEADER_SIZE) {
+    return false;
+  }
+  auto innerType = static_cast<ReplFrameType>(payload[0]);
+  size_t rawLength = repl_get_le(payload.data() + 1, 4);
+  if (innerType == ReplFrameType::COMPRESSED || rawLength > maxPayload ||
+      !decompressor.Decompress(payload.substr(ReplProtocol::COMPRESSED_HEADER_SIZE), rawLength, payload)) {
+    return false;
+  }
+  header.type = innerType;
+  header.payloadLength = static_cast<uint32_t>(rawLength);
   return true;
 }
 
+// Prideda vieną WRITE/DELETE įrašą prie RECORDS payload'o.
+static inline void repl_append_record(string& out, const WalRecord& record) {
+  out.push_back(static_cast<char>(record.operation));
+  repl_put_le(out, record.lsn, 8);
+  repl_put_le(out, record.key.size(), 2);
+  repl_put_le(out, record.value.size(), 4);
+  out += record.key;
+  out += record.value;
+}
+
+// Iššifruoja įrašą iš payload[offset]. key/value priskiriami į esamus string'us (be naujų alokacijų, kai talpos užtenka).
+static inline bool repl_decode_record(std::string_view payload, size_t& offset, WalRecord& record) {
+  if (payload.size() - offset < ReplProtocol::RECORD_HEADER_SIZE) {
+    return false;
+  }
+  const char* data = payload.data() + offset;
+  auto operation = static_cast<uint8_t>(data[0]);
+  size_t keyLength = repl_get_le(data + 9, 2);
+  size_t valueLength = repl_get_le(data + 11, 4);
+  if (operation > static_cast<uint8_t>(WalOperation::DELETE) ||
+      payload.size() - offset - ReplProtocol::RECORD_HEADER_SIZE < keyLength + valueLength) {
+    return false;
+  }
+  record.operation = static_cast<WalOperation>(operation);
+  record.lsn = repl_get_le(data + 1, 8);
+  record.key.assign(data + ReplProtocol::RECORD_HEADER_SIZE, keyLength);
+  record.value.assign(data + ReplProtocol::RECORD_HEADER_SIZE + keyLength, valueLength);
+  offset += ReplProtocol::RECORD_HEADER_SIZE + keyLength + valueLength;
+  return true;
+}
+
+static inline bool send_repl_frame(sock_t socketHandle, ReplFrameType type, uint32_t count, uint64_t lsn) {
+  string frame;
+  repl_append_frame_header(frame, type, count, lsn, 0);
+  return send_all(socketHandle, frame);
+}
+
+// Perskaito vieną kadrą. payload - view į reader'io buferį (galioja iki kito skaitymo). Per didelis payload - klaida.
+static inline bool recv_repl_frame(SocketReader& reader, ReplFrameHeader& header, std::string_view& payload, size_t maxPayload) {
+  std::string_view rawHeader;
+  if (!reader.ReadExact(ReplProtocol::FRAME_HEADER_SIZE, rawHeader)) {
+    return false;
+  }
+  const char* raw = rawHeader.data();
+  header.version = static_cast<uint8_t>(raw[0]);
+  header.type = static_cast<ReplFrameType>(raw[1]);
+  header.count = static_cast<uint32_t>(repl_get_le(raw + 2, 4));
+  header.lsn = repl_get_le(raw + 6, 8);
+  header.payloadLength = static_cast<uint32_t>(repl_get_le(raw + 14, 4));
+  if (header.version != ReplProtocol::BINARY_VERSION || header.payloadLength > maxPayload) {
+    return false;
+  }
+  return reader.ReadExact(header.payloadLength, payload);
+}
+
 /* ===================== Utility helpers (string) ===================== */
 
 // Nukerpa tarpus pradžioje ir pabaigoje nuo string’o.
@@ -330,14 +577,14 @@ static inline string format_length_prefixed_value(const string& value) {
  *
  * @param tokens - Tokenized command (e.g., ["SET", "key", "11", "Hello", "World"])
  * @param start_idx - Index where value_len starts (e.g., 2 for SET command)
- * @param socket - Socket to read remaining bytes if needed
+ * @param reader - Connection reader to read remaining bytes from if needed
  * @param out_value - Output parameter for parsed value
  * @return true if successfully parsed, false otherwise
  */
 static inline bool parse_length_prefixed_value(
     const vector<string>& tokens,
     size_t start_idx,
-    sock_t socket,
+    SocketReader& reader,
     string& out_value
 ) {
   if (start_idx >= tokens.size()) {
@@ -378,26 +625,26 @@ static inline bool parse_length_prefixed_value(
   size_t bytes_needed = value_len - reconstructed.length();
   out_value = reconstructed;
 
-  // If reconstructed has content but we need more, add back the newline that recv_line() stripped
+  // If reconstructed has content but we need more, add back the newline that ReadLine() stripped
   if (bytes_needed > 0 && reconstructed.length() > 0) {
     out_value += "\n";
     bytes_needed -= 1;
   }
 
-  if (bytes_needed > 0 && socket != NET_INVALID) {
-    vector<char> buffer(bytes_needed);
-    size_t total_read = 0;
+  if (bytes_needed > 0 && reader.Socket() != NET_INVALID) {
+    std::string_view remainder;
+    if (!reader.ReadExact(bytes_needed, remainder)) {
+      log_line(LogLevel::ERROR, "Failed to read remaining value bytes");
+      return false;
+    }
+    out_value.append(remainder.data(), remainder.size());
 
-    while (total_read < bytes_needed) {
-      ssize_t received = recv(socket, buffer.data() + total_read,
-                             bytes_needed - total_read, 0);
-      if (received <= 0) {
-        log_line(LogLevel::ERROR, "Failed to read remaining value bytes");
-        return false;
-      }
-      total_read += received;
+    // Žinutę baigiantis '\n' po reikšmės - kad kita eilutė nebūtų tuščia.
+    char trailing = 0;
+    if (reader.Peek(trailing) && trailing == '\n') {
+      std::string_view newline;
+      reader.ReadExact(1, newline);
     }
-    out_value.append(buffer.data(), bytes_needed);
   }
 
   return out_value.length() == value_len;
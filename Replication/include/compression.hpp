@@ -0,0 +1,212 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* ===================== LZ srautinis kodekas (replikacijos kadrams) ===================== */
+
+// LZ77 šeimos kodekas, LZ4 bloko formatas, be išorinių bibliotekų. Blokas - sekos:
+//   token(1) = literalų ilgis (4 aukšti bitai) | match ilgis - LZ_MIN_MATCH (4 žemi bitai)
+//   [literalų ilgio tęsinys: 255, 255, ..., < 255] | literalai | offset(2, LE) | [match ilgio tęsinys]
+// Paskutinė seka turi tik literalus (paskutiniai LZ_LAST_LITERALS baitų niekada nėra match'o dalis).
+// Match'ai gali rodyti ir į ankstesnius to paties srauto blokus (iki LZ_MAX_OFFSET atgal), todėl ir kadras su keliais
+// įrašais suspaudžiamas, jei jo turinys panašus į ankstesnių (pvz. JSON raktai).
+static constexpr size_t LZ_MIN_MATCH     = 4;
+static constexpr size_t LZ_LAST_LITERALS = 5;
+static constexpr size_t LZ_MAX_OFFSET    = 65535;
+static constexpr size_t LZ_WINDOW_BYTES  = 64UL * 1024UL; // kiek istorijos laiko abi pusės (>= LZ_MAX_OFFSET)
+static constexpr int    LZ_HASH_BITS     = 14;
+
+static inline uint32_t lz_read32(const char* data) {
+  uint32_t value = 0;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static inline uint32_t lz_hash(uint32_t sequence) {
+  return (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static inline void lz_put_length(std::string& out, size_t length) {
+  while (length >= 255) {
+    out.push_back(static_cast<char>(255));
+    length -= 255;
+  }
+  out.push_back(static_cast<char>(length));
+}
+
+static inline bool lz_read_length(std::string_view input, size_t& position, size_t& length) {
+  while (position < input.size()) {
+    auto byte = static_cast<uint8_t>(input[position++]);
+    length += byte;
+    if (byte != 255) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline void lz_append_literals(std::string& out, uint8_t matchCode, const char* literals, size_t literalLength) {
+  out.push_back(static_cast<char>((std::min<size_t>(literalLength, 15) << 4) | matchCode));
+  if (literalLength >= 15) {
+    lz_put_length(out, literalLength - 15);
+  }
+  out.append(literals, literalLength);
+}
+
+// Suspaudžia data[start, end) ir prideda bloką prie out. Match'ai gali rodyti ir į data[0, start).
+// hashTable saugo srauto pozicijas (positionBase + indeksas data), todėl ji tinka ir kitiems srauto blokams;
+// kandidatas visada patikrinamas pagal turinį, tad pasenę įrašai lentelėje tik praleidžiami.
+static inline void lz_compress_block(const char* data, size_t start, size_t end, uint64_t positionBase,
+                                     std::string& out, std::vector<uint32_t>& hashTable) {
+  if (hashTable.size() != (size_t{1} << LZ_HASH_BITS)) {
+    hashTable.assign(size_t{1} << LZ_HASH_BITS, 0);
+  }
+  size_t anchor = start;
+
+  if (end - start > LZ_MIN_MATCH + LZ_LAST_LITERALS) {
+    size_t matchLimit = end - LZ_LAST_LITERALS;
+    size_t position = start;
+    while (position + LZ_MIN_MATCH <= matchLimit) {
+      uint32_t sequence = lz_read32(data + position);
+      uint32_t& slot = hashTable[lz_hash(sequence)];
+      auto streamPosition = static_cast<uint32_t>(positionBase + position);
+      uint32_t distance = streamPosition - slot;
+      slot = streamPosition;
+      if (distance == 0 || distance > LZ_MAX_OFFSET || distance > position ||
+          lz_read32(data + position - distance) != sequence) {
+        // Nesuspaudžiamoje vietoje žingsnis didėja, kad atsitiktiniai duomenys neužtruktų.
+        position += 1 + ((position - anchor) >> 6);
+        continue;
+      }
+
+      size_t candidate = position - distance;
+      size_t matchLength = LZ_MIN_MATCH;
+      while (position + matchLength < matchLimit && data[candidate + matchLength] == data[position + matchLength]) {
+        matchLength++;
+      }
+      size_t matchCode = matchLength - LZ_MIN_MATCH;
+      lz_append_literals(out, static_cast<uint8_t>(std::min<size_t>(matchCode, 15)), data + anchor, position - anchor);
+      out.push_back(static_cast<char>(distance & 0xFFU));
+      out.push_back(static_cast<char>((distance >> 8) & 0xFFU));
+      if (matchCode >= 15) {
+        lz_put_length(out, matchCode - 15);
+      }
+      position += matchLength;
+      anchor = position;
+    }
+  }
+
+  lz_append_literals(out, 0, data + anchor, end - anchor);
+}
+
+// Išskleidžia bloką (rawLength baitų) ir prideda prie out. Match'ai gali rodyti į ankstesnį out turinį.
+// Sugadintas blokas - false (out gale lieka šiukšlės).
+static inline bool lz_decompress_block(std::string_view input, size_t rawLength, std::string& out) {
+  size_t written = out.size();
+  size_t total = written + rawLength;
+  out.resize(total);
+  char* destination = &out[0];
+  size_t position = 0;
+
+  while (position < input.size()) {
+    auto token = static_cast<uint8_t>(input[position++]);
+
+    size_t literalLength = token >> 4;
+    if (literalLength == 15 && !lz_read_length(input, position, literalLength)) {
+      return false;
+    }
+    if (input.size() - position < literalLength || total - written < literalLength) {
+      return false;
+    }
+    std::memcpy(destination + written, input.data() + position, literalLength);
+    position += literalLength;
+    written += literalLength;
+    if (position == input.size()) {
+      break; // paskutinė seka - tik literalai
+    }
+
+    if (input.size() - position < 2) {
+      return false;
+    }
+    size_t offset = static_cast<uint8_t>(input[position]) | (static_cast<size_t>(static_cast<uint8_t>(input[position + 1])) << 8);
+    position += 2;
+    size_t matchLength = token & 0x0FU;
+    if (matchLength == 15 && !lz_read_length(input, position, matchLength)) {
+      return false;
+    }
+    matchLength += LZ_MIN_MATCH;
+    if (offset == 0 || offset > written || total - written < matchLength) {
+      return false;
+    }
+
+    // Match'as gali persidengti su savimi (offset < ilgis), todėl tada kopijuojama po baitą.
+    const char* source = destination + written - offset;
+    if (offset >= matchLength) {
+      std::memcpy(destination + written, source, matchLength);
+    } else {
+      for (size_t i = 0; i < matchLength; i++) {
+        destination[written + i] = source[i];
+      }
+    }
+    written += matchLength;
+  }
+  return written == total;
+}
+
+// Vieno ryšio (sesijos) suspaudimo būsena. Siuntėjas ir gavėjas laiko paskutinius LZ_WINDOW_BYTES išskleistų
+// duomenų; į istoriją patenka tik suspausti blokai, todėl abiejų pusių istorija sutampa.
+class LzStream {
+private:
+  std::string history;             // istorija + paskutinis blokas
+  uint64_t positionBase{0};        // history[0] pozicija sraute
+  std::vector<uint32_t> hashTable; // tik siuntėjui
+
+  // Ilgiau nei 2 langai istorija nelaikoma (trinama retai, kad nereiktų kopijuoti kiekvienam kadrui).
+  void TrimHistory() {
+    if (this->history.size() > 2 * LZ_WINDOW_BYTES) {
+      size_t drop = this->history.size() - LZ_WINDOW_BYTES;
+      this->history.erase(0, drop);
+      this->positionBase += drop;
+    }
+  }
+
+public:
+  void Reset() {
+    this->history.clear();
+    this->positionBase = 0;
+    this->hashTable.clear();
+  }
+
+  // Prideda suspaustą input bloką prie out. Jei blokas nebūtų mažesnis už maxBlockSize, grąžina false, o out ir
+  // istorija lieka nepakeisti (kviečiantysis siunčia nesuspaustą kadrą).
+  bool Compress(std::string_view input, std::string& out, size_t maxBlockSize) {
+    this->TrimHistory();
+    size_t start = this->history.size();
+    this->history.append(input.data(), input.size());
+    size_t outStart = out.size();
+    lz_compress_block(this->history.data(), start, this->history.size(), this->positionBase, out, this->hashTable);
+    if (out.size() - outStart >= maxBlockSize) {
+      out.resize(outStart);
+      this->history.resize(start);
+      return false;
+    }
+    return true;
+  }
+
+  // Išskleidžia bloką. output - view į istoriją, galioja iki kito Decompress/Reset.
+  bool Decompress(std::string_view block, size_t rawLength, std::string_view& output) {
+    this->TrimHistory();
+    size_t start = this->history.size();
+    if (!lz_decompress_block(block, rawLength, this->history)) {
+      this->history.resize(start);
+      return false;
+    }
+    output = std::string_view(this->history).substr(start, rawLength);
+    return true;
+  }
+};
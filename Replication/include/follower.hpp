@@ -3,8 +3,12 @@
 #include "../../btree/include/database.h"
 #include "common.hpp"
 #include <atomic>
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
+#include <fstream>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
@@ -34,9 +38,35 @@ private:
     std::unique_ptr<Database> duombaze;
     bool running{true};
 
+    // Replikacijos protokolas (sutartas per HELLO). Kadrų buferiai naudojami pakartotinai.
+    uint8_t protocolVersion{ReplProtocol::TEXT_VERSION};
+    uint8_t helloVersion{ReplProtocol::COMPRESSION_VERSION}; // siūloma HELLO; senam leader'iui atmetus - mažinama
+    SocketReader leaderReader;        // visi skaitymai iš currentLeaderSocket
+    ReplFrameHeader frameHeader;
+    std::string_view framePayload;    // view į leaderReader buferį (arba į decompressor, jei kadras buvo suspaustas)
+    LzStream decompressor;            // COMPRESSED kadrų srautas, naujas kiekvienai sesijai
+    WalRecord frameRecord;
+
+    // Gaunamas snapshot'as (SNAPSHOT_BEGIN..SNAPSHOT_END), puslapiai rašomi tiesiai į Database::GetSnapshotInstallPath().
+    std::ofstream snapshotFile;
+    uint64_t snapshotLsn{0};
+    uint32_t snapshotPages{0};
+    uint32_t snapshotPagesReceived{0};
+
+    // Įrašai, jau esantys WAL'e (ACK'inami vos tapę durable), bet dar nepritaikyti medžiui.
+    // Juos paketais pritaiko applierThread, receiver'is laukia, kai eilė viršija FOLLOWER_APPLY_QUEUE_BYTES.
+    std::mutex applyMutex;
+    std::condition_variable applyQueueChanged;
+    std::deque<WalRecord> applyQueue;
+    size_t applyQueueBytes{0};
+    bool applyingBatch{false};
+
     atomic<sock_t> readListenSocket{NET_INVALID};
     atomic<sock_t> currentLeaderSocket{NET_INVALID};
     thread readOnlyThread;
+    thread defragThread;
+    thread checkpointThread;
+    thread applierThread;
 
 
     // Susije su connect'ingu prie leader.
@@ -48,8 +78,21 @@ private:
     SessionStatus RunReplicationSession(uint64_t &myLsn);
     bool ApplySetRecord(const vector<string> &tokens, uint64_t &currentLsn);
     bool ApplyDeleteRecord(const vector<string> &tokens, uint64_t &currentLsn);
+    bool ApplyBatch(const vector<string> &tokens, uint64_t &currentLsn);
+    bool ApplyRecord(WalRecord &walRecord, uint64_t &currentLsn);
+    bool ApplyFramedRecord(WalRecord &walRecord, uint64_t &currentLsn);
+    bool ProcessFrame(uint64_t &myLsn);
+    bool ApplyRecordsFrame(uint64_t &myLsn);
+    bool BeginSnapshot();
+    bool WriteSnapshotPages();
+    bool InstallSnapshot(uint64_t &myLsn);
     bool ProcessCommandLine(const string &line, uint64_t &myLsn);
 
+    // Medžio atnaujinimas atskirame thread'e.
+    void QueueForApply(const WalRecord &walRecord);
+    void ApplyLoop();
+    void WaitApplied();
+
     // Susije su klientu.
     void ServeReadOnly(); // Veikia main thread'e.
     void HandleClient(sock_t clientSocket);
@@ -62,6 +105,10 @@ private:
     // Reset'inimas.
     bool ApplyResetWAL(uint64_t &localLSN);
 
+    // Background lapų defragmentacija ir checkpoint'ai.
+    void DefragLoop();
+    void CheckpointLoop();
+
 public:
     Follower(string leaderHost, uint16_t leaderPort, string dbName, uint16_t readPort, int nodeId = 0);
     ~Follower();
@@ -5,6 +5,7 @@
 #include <vector>
 #include <condition_variable>
 #include <cstdint>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <thread>
@@ -23,6 +24,9 @@ using std::atomic;
 // Informacija apie vieną follower'io ryšį leader'yje.
 // Laikom socket'ą, iki kokio lsn follower'is patvirtino (ACK),
 // ir ar jis dar laikomas gyvu.
+// Įrašus follower'iui siunčia jo sender thread'as: rašytojai tik įdeda įrašą į sendQueue (be tinklo I/O).
+// Jei eilė viršija FOLLOWER_SEND_QUEUE_BYTES, ji išvaloma ir sender'is skaito iš WAL nuo sentUptoLsn.
+// Follower'is, kurio trūkstamų įrašų WAL'e nebėra, pirmiausia gauna puslapių snapshot'ą (SendSnapshot).
 struct FollowerConnection {
   int      id{0};  // Follower node ID (1-4)
   sock_t   followerSocket{NET_INVALID};
@@ -30,6 +34,22 @@ struct FollowerConnection {
   bool     isAlive{true};
   uint64_t lastSeenMs{0};  // Timestamp when follower was last seen (for status caching)
   mutex    connectionMutex;
+
+  // Siuntimo eilė (saugoma queueMutex).
+  mutex                        queueMutex;
+  condition_variable           queueChanged;
+  std::map<uint64_t, WalRecord> sendQueue;      // LSN tvarka, nors rašytojai įdeda bet kokia tvarka
+  size_t                       queuedBytes{0};
+  bool                         readFromWal{true}; // eilė nepilna: trūkstami įrašai skaitomi iš WAL
+  uint64_t                     session{0};       // didinamas po kiekvieno HELLO, senas sender'is baigia darbą
+  atomic<uint64_t>             sentUptoLsn{0};
+  uint8_t                      protocolVersion{ReplProtocol::TEXT_VERSION}; // sutarta per HELLO
+};
+
+// Rašytojas, laukiantis, kol jo LSN patvirtins kvorumas (Leader::WaitForAcks).
+struct CommitWaiter {
+  condition_variable committed;
+  bool               done{false};
 };
 
 // How long to consider a follower "recently seen" for status reporting (10 seconds)
@@ -48,17 +68,25 @@ private:
     unique_ptr<Database> duombaze;
     vector<shared_ptr<FollowerConnection>> followers;
     bool running{true};
-    atomic<bool> maintenanceMode{false}; // "Stabdome pasaulį" flag'as.
 
     // Synchronization
     mutex mtx;
-    condition_variable conditionVariable;
+    // WAL retention (TrimWal) ir naujo follower'io registracija (HELLO) nevyksta vienu metu: kitaip follower'is,
+    // kuriam snapshot'o nereikėjo, galėtų prarasti dar neperskaitytus segmentus. Imama prieš mtx.
+    mutex retentionMutex;
+
+    // Commit index: requiredAcks-tas didžiausias gyvų follower'ių ACK LSN (saugoma mtx), perskaičiuojamas po kiekvieno ACK.
+    // Rašytojai laukia LSN tvarka surikiuotame sąraše ir pažadinami tik kartą - kai jų LSN patvirtintas.
+    uint64_t commitLsn{0};
+    std::multimap<uint64_t, CommitWaiter *> commitWaiters;
+    vector<uint64_t> ackedLsnScratch;
 
     // Thread Management
     thread announceThread;
     thread followerAcceptThread;
     thread clientAcceptThread;
-    thread compactionThread;
+    thread checkpointThread;
+    thread defragThread;
 
     // We store listening sockets to close them in destructor (waking up accept threads)
     atomic<sock_t> clientListenSocket{NET_INVALID};
@@ -72,7 +100,7 @@ private:
     void HandleClient(sock_t clientSocket);
 
     // Helper'iai, kad nebūtų painus kodas.
-    void HandleSet(sock_t clientSocket, const vector<string> &tokens);
+    void HandleSet(sock_t clientSocket, SocketReader &reader, const vector<string> &tokens);
     void HandleDel(sock_t clientSocket, const vector<string> &tokens);
     void HandleGet(sock_t clientSocket, const string &key);
     void HandleRangeQuery(sock_t clientSocket, const vector<string> &tokens, bool forward);
@@ -81,20 +109,25 @@ private:
     void HandleGetKeysPaging(sock_t clientSocket, const vector<string> &tokens);
 
     // Logic
-    void BroadcastWalRecord(const WalRecord &walRecord);
+    void EnqueueForFollowers(const WalRecord &walRecord);
+    void SendToFollower(shared_ptr<FollowerConnection> follower, sock_t followerSocket, uint64_t session, uint8_t protocolVersion,
+                        bool sendSnapshot);
+    bool SendFromWal(FollowerConnection &follower, sock_t followerSocket, uint8_t protocolVersion, LzStream *compressor);
+    bool SendSnapshot(FollowerConnection &follower, sock_t followerSocket, uint64_t session, LzStream *compressor);
+    bool NeedsSnapshot(uint64_t followerLsn, bool hasLsnBase, uint64_t followerLsnBase);
     size_t CountAcks(uint64_t lsn);
-    void WaitForAcks(uint64_t lsn);
+    void UpdateCommitIndex();
+    bool WaitForAcks(uint64_t lsn);
 
-    // "Stabdome pasaulį" logika.
-    void AutoCompactLoop();
-    bool IsClusterHealthy();
+    // Checkpoint'ai, WAL retention ir lapų defragmentacija background'e (COMPACT - retention iš karto).
+    void CheckpointLoop();
+    void TrimWal();
+    void DefragLoop();
+    void HandleCompact(sock_t clientSocket);
 
     // Quorum checks for distributed consensus
     int CountAliveFollowers();
     bool HasQuorum();  // Returns true if >= 2 followers alive (3+ total nodes)
-    void HandleCompact(sock_t clientSocket);
-    bool PerformCompaction(string &statusMsg);
-    void BroadcastReset();
 
 public:
     Leader(string dbName, uint16_t clientPort, uint16_t followerPort, int requiredAcks, string host);
@@ -1,10 +1,15 @@
 #pragma once
 
+#include <chrono>
 #include <cstdint>
+#include <functional>
 #include <string>
 #include <mutex>
 #include <atomic>
 #include <iostream>
+#include <thread>
+#include "../../btree/include/database.h"
+#include "../../btree/include/logger.hpp"
 
 // Statinė informacija apie vieną klasterio mazgą.
 struct NodeInfo {
@@ -37,6 +42,78 @@ static constexpr int HEARTBEAT_INTERVAL_MS = 200;   // kas kiek siųsti heartbea
 static constexpr int HEARTBEAT_TIMEOUT_MS  = 2000;  // po kiek laikyti leader'į mirusiu
 static constexpr int ELECTION_TIMEOUT_MS   = 2500;  // minimalus laukimas iki rinkimų starto
 
+// Background lapų defragmentacija (I/O biudžetas: DEFRAG_PAGES_PER_TICK lapų kas DEFRAG_TICK_MS).
+static constexpr double   DEFRAG_DEAD_RATIO     = 0.25;  // defragmentuojam lapą, kai negyva dalis >= 25%
+static constexpr uint32_t DEFRAG_PAGES_PER_TICK = 8;     // ~80 lapų (~1.3 MB) per sekundę
+static constexpr int      DEFRAG_TICK_MS        = 100;
+static constexpr int      DEFRAG_IDLE_MS        = 10000; // pauzė po pilno praėjimo, kuriame nieko nerasta
+
+// Checkpoint'as: puslapiai fsync'inami ir WAL segmentai iki min(checkpoint, lėčiausio follower'io ACK) trinami.
+static constexpr int      CHECKPOINT_INTERVAL_MS = 5000;
+// Po checkpoint'o iki tiek uždarytų WAL segmentų suspaudžiama (paliekamas tik naujausias kiekvieno rakto įrašas).
+static constexpr size_t   WAL_COMPACTION_MAX_SEGMENTS = 4;
+
+// Background thread'ų miegas: pabunda kas DEFRAG_TICK_MS, kad sustabdytas mazgas (running = false) ilgai nelauktų.
+static inline void sleep_while_running(int sleepMs, const bool &running) {
+    for (int slept = 0; slept < sleepMs && running; slept += DEFRAG_TICK_MS) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(DEFRAG_TICK_MS));
+    }
+}
+
+// Leader'io ir follower'io DefragLoop: po truputį defragmentuoja lapus su daug negyvos vietos.
+// Per tick'ą perskaito ne daugiau DEFRAG_PAGES_PER_TICK lapų, kad klientų latency nepasikeistų;
+// po praėjimo, kuriame nieko nerasta, laukia DEFRAG_IDLE_MS.
+static inline void run_defrag_loop(Database &database, const bool &running,
+                                   const std::function<void(const std::string &)> &logWarning) {
+    bool passHadWork = false;
+    while (running) {
+        int sleepMs = DEFRAG_TICK_MS;
+        try {
+            auto result = database.DefragmentLeaves(DEFRAG_DEAD_RATIO, DEFRAG_PAGES_PER_TICK);
+            passHadWork = passHadWork || result.pagesDefragmented > 0;
+            if (result.passFinished) {
+                if (!passHadWork) {
+                    sleepMs = DEFRAG_IDLE_MS;
+                }
+                passHadWork = false;
+            }
+        } catch (const std::exception& ex) {
+            logWarning(std::string("[Defrag] Failed: ") + ex.what());
+            sleepMs = DEFRAG_IDLE_MS;
+        }
+        sleep_while_running(sleepMs, running);
+    }
+}
+
+// WAL durability: kada įrašas laikomas durable (fdatasync) ir klientui/leader'iui atsakoma OK/ACK.
+// PER_COMMIT - fdatasync kiekvienam įrašui, GROUP - vienas fdatasync grupei (laukiama iki WAL_GROUP_COMMIT_DELAY_US),
+// INTERVAL - fdatasync kas WAL_SYNC_INTERVAL_MS, atsakoma nelaukiant.
+static constexpr WalSyncPolicy WAL_SYNC_POLICY          = WalSyncPolicy::GROUP;
+static constexpr int           WAL_GROUP_COMMIT_DELAY_US = 200;
+static constexpr int           WAL_SYNC_INTERVAL_MS      = 10;
+
+// Replikacija: visi siuntimo metu turimi įrašai siunčiami vienu BATCH kadru iki REPLICATION_BATCH_BYTES
+// (ACK'ų nelaukiama, keli kadrai gali būti kelyje). Follower'is atmeta kadrus, didesnius nei REPLICATION_BATCH_MAX_BYTES.
+static constexpr size_t REPLICATION_BATCH_BYTES     = 64UL * 1024UL;
+static constexpr size_t REPLICATION_BATCH_MAX_BYTES = 16UL * 1024UL * 1024UL;
+
+// Kiekvieno follower'io siuntimo eilė. Lėtas follower'is, kurio eilė viršija FOLLOWER_SEND_QUEUE_BYTES, toliau gauna
+// įrašus iš WAL; jei eilėje trūksta įrašo ilgiau nei FOLLOWER_QUEUE_GAP_MS, jis taip pat paimamas iš WAL.
+static constexpr size_t FOLLOWER_SEND_QUEUE_BYTES = 4UL * 1024UL * 1024UL;
+static constexpr int    FOLLOWER_QUEUE_GAP_MS     = 50;
+
+// Replikacijos kadrų (RECORDS, SNAPSHOT_PAGES) LZ suspaudimas, jei follower'is jį palaiko (sutariama per HELLO).
+static constexpr bool REPLICATION_COMPRESSION = true;
+
+// Follower'is įrašą ACK'ina, kai jis durable WAL'e; medžiui įrašai pritaikomi atskirame thread'e iki
+// FOLLOWER_APPLY_BATCH_RECORDS vienu tree lock'u. Nepritaikytų įrašų eilė ribojama FOLLOWER_APPLY_QUEUE_BYTES.
+static constexpr size_t FOLLOWER_APPLY_BATCH_RECORDS = 512;
+static constexpr size_t FOLLOWER_APPLY_QUEUE_BYTES   = 16UL * 1024UL * 1024UL;
+
+// Follower'iui, kurio istorijos WAL'e nebėra (WAL ištrintas, reset'intas ar follower'is tuščias), siunčiama puslapių kopija
+// SNAPSHOT_CHUNK_BYTES dydžio SNAPSHOT_PAGES kadrais (turi būti <= REPLICATION_BATCH_MAX_BYTES).
+static constexpr size_t SNAPSHOT_CHUNK_BYTES = 1024UL * 1024UL;
+
 // Mazgo būsena Raft stiliaus protokole.
 enum class NodeState : uint8_t { FOLLOWER, CANDIDATE, LEADER };
 
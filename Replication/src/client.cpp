@@ -54,8 +54,9 @@ static bool do_request_follow_redirect(const string& initialHost,
 
   send_all(socketMain, payload + "\n");
 
+  SocketReader mainReader(socketMain);
   string responseLine;
-  if (!recv_line(socketMain, responseLine)) {
+  if (!mainReader.ReadLine(responseLine)) {
     net_close(socketMain);
     std::cerr << "ERR_NO_REPLY\n";
     return false;
@@ -81,8 +82,9 @@ static bool do_request_follow_redirect(const string& initialHost,
 
     send_all(socketRedirect, payload + "\n");
 
+    SocketReader redirectReader(socketRedirect);
     string redirectedResponse;
-    if (!recv_line(socketRedirect, redirectedResponse)) {
+    if (!redirectReader.ReadLine(redirectedResponse)) {
       net_close(socketRedirect);
       std::cerr << "ERR_NO_REPLY\n";
       return false;
@@ -92,7 +94,7 @@ static bool do_request_follow_redirect(const string& initialHost,
     auto redirectParts = split(trim(redirectedResponse), ' ');
     if (!redirectParts.empty() && redirectParts[0] == "VALUE" && redirectParts.size() >= 2) {
       string value;
-      if (parse_length_prefixed_value(redirectParts, 1, socketRedirect, value)) {
+      if (parse_length_prefixed_value(redirectParts, 1, redirectReader, value)) {
         cout << "VALUE " << value << "\n";
       } else {
         cout << redirectedResponse << "\n";
@@ -107,7 +109,7 @@ static bool do_request_follow_redirect(const string& initialHost,
   // Parse length-prefixed VALUE response from initial request
   if (!responseParts.empty() && responseParts[0] == "VALUE" && responseParts.size() >= 2) {
     string value;
-    if (parse_length_prefixed_value(responseParts, 1, socketMain, value)) {
+    if (parse_length_prefixed_value(responseParts, 1, mainReader, value)) {
       cout << "VALUE " << value << "\n";
     } else {
       cout << responseLine << "\n";
@@ -161,8 +163,9 @@ static bool detect_leader_host(string &leaderHostOut) {
     // Verify it's actually a leader by sending a test GET command
     set_socket_timeouts(sock, 1000);  // 1 second timeout
     send_all(sock, "GET __leader_check__\n");
+    SocketReader reader(sock);
     string line;
-    if (recv_line(sock, line)) {
+    if (reader.ReadLine(line)) {
       auto parts = split(trim(line), ' ');
       // Leader responds with VALUE or NOT_FOUND, not ERR_READ_ONLY
       if (parts.size() > 0 && (parts[0] == "VALUE" || parts[0] == "NOT_FOUND")) {
@@ -219,8 +222,9 @@ int main(int argc, char** argv) {
       nodeStatus.id = node.id;
       nodeStatus.reachable = true;
 
+      SocketReader reader(sock);
       string line;
-      while (recv_line(sock, line)) {
+      while (reader.ReadLine(line)) {
         line = trim(line);
         if (line == "END") {
           break;
@@ -240,7 +244,7 @@ int main(int argc, char** argv) {
             detectedLeaderHost = node.host;
           }
         } else if (tokens.size() >= 4 && tokens[0] == "FOLLOWER_STATUS") {
-          // FOLLOWER_STATUS <followerId> <status> <lsn>
+          // FOLLOWER_STATUS <followerId> <status> <lsn> [<lagLsn> <queuedBytes>]
           int followerId = std::stoi(tokens[1]);
           string status = tokens[2];
           uint64_t followerLsn = std::stoull(tokens[3]);
@@ -430,8 +434,9 @@ int main(int argc, char** argv) {
 
     send_all(sock, "GETFF " + key + " " + count + "\n");
 
+    SocketReader reader(sock);
     string line;
-    while (recv_line(sock, line)) {
+    while (reader.ReadLine(line)) {
       if (line == "END") {
         break;
       }
@@ -454,8 +459,9 @@ int main(int argc, char** argv) {
 
     send_all(sock, "GETFB " + key + " " + count + "\n");
 
+    SocketReader reader(sock);
     string line;
-    while (recv_line(sock, line)) {
+    while (reader.ReadLine(line)) {
       if (line == "END") {
         break;
       }
@@ -470,8 +476,9 @@ int main(int argc, char** argv) {
 
       send_all(sock, "COMPACT\n");
 
+      SocketReader reader(sock);
       string response;
-      if (recv_line(sock, response)) {
+      if (reader.ReadLine(response)) {
         cout << response << "\n";
       }
     }
@@ -493,9 +500,10 @@ int main(int argc, char** argv) {
     string cmd = prefix.empty() ? "GETKEYS" : ("GETKEYS " + prefix);
     send_all(sock, cmd + "\n");
 
+    SocketReader reader(sock);
     string line;
     int count = 0;
-    while (recv_line(sock, line)) {
+    while (reader.ReadLine(line)) {
       if (line == "END") {
         break;
       }
@@ -526,10 +534,11 @@ int main(int argc, char** argv) {
 
     send_all(sock, "GETKEYSPAGING " + pageSize + " " + pageNum + "\n");
 
+    SocketReader reader(sock);
     string line;
     uint64_t total = 0;
     int count = 0;
-    while (recv_line(sock, line)) {
+    while (reader.ReadLine(line)) {
       if (line == "END") {
         break;
       }
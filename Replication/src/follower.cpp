@@ -34,6 +34,9 @@ Follower::Follower(string leaderHost, uint16_t leaderPort, string dbName, uint16
              " DB: " + this->dbName + " ReadPort: " + std::to_string(this->readPort));
 
     this->duombaze = std::make_unique<Database>(this->dbName);
+    this->duombaze->ConfigureWalSync(WAL_SYNC_POLICY,
+                                     std::chrono::microseconds(WAL_GROUP_COMMIT_DELAY_US),
+                                     std::chrono::milliseconds(WAL_SYNC_INTERVAL_MS));
 }
 
 Follower::~Follower() {
@@ -51,15 +54,33 @@ Follower::~Follower() {
         this->currentLeaderSocket = NET_INVALID;
     }
 
-    // 3. Join the background thread
+    // 3. Applier'is pritaiko likusius įrašus ir baigia darbą.
+    {
+        std::lock_guard<std::mutex> lock(this->applyMutex);
+    }
+    this->applyQueueChanged.notify_all();
+
+    // 4. Join the background threads
     if (this->readOnlyThread.joinable()) {
         this->readOnlyThread.join();
     }
+    if (this->defragThread.joinable()) {
+        this->defragThread.join();
+    }
+    if (this->checkpointThread.joinable()) {
+        this->checkpointThread.join();
+    }
+    if (this->applierThread.joinable()) {
+        this->applierThread.join();
+    }
 }
 
 void Follower::Run() {
     // 1. Pradedame sinchronizaciją su lyderiu background'e.
     this->readOnlyThread= thread(&Follower::ServeReadOnly, this);
+    this->defragThread = thread(&Follower::DefragLoop, this);
+    this->checkpointThread = thread(&Follower::CheckpointLoop, this);
+    this->applierThread = thread(&Follower::ApplyLoop, this);
 
     // 2. Aktyvuojame Read-Only pagrindiniame thread'e.
     this->SyncWithLeader();
@@ -70,6 +91,31 @@ void Follower::Run() {
     }
 }
 
+// Background'e po truputį defragmentuoja lapus su daug negyvos vietos (run_defrag_loop).
+void Follower::DefragLoop() {
+    run_defrag_loop(*this->duombaze, this->running,
+                    [](const string &message) { FollowerLog(LogLevel::WARN, message); });
+}
+
+// Periodiškai daro checkpoint'ą ir trina WAL segmentus iki jo.
+void Follower::CheckpointLoop() {
+    while (this->running) {
+        sleep_while_running(CHECKPOINT_INTERVAL_MS, this->running);
+
+        if (!this->running) {
+            continue;
+        }
+
+        try {
+            uint64_t checkpointLsn = this->duombaze->Checkpoint();
+            this->duombaze->TruncateWal(checkpointLsn);
+            this->duombaze->RecycleWalSegments();
+        } catch (const std::exception& ex) {
+            FollowerLog(LogLevel::WARN, string("[Checkpoint] Failed: ") + ex.what());
+        }
+    }
+}
+
 void Follower::SyncWithLeader() {
     int failureCount = 0;
     int backoffMs = BASE_BACKOFF_MS;
@@ -99,6 +145,7 @@ void Follower::SyncWithLeader() {
         // Užtikriname, kad nekabėsime, jei lyderis prapuls.
         set_socket_timeouts(leaderSocket, Consts::SOCKET_TIMEOUT_MS);
         this->currentLeaderSocket = leaderSocket;
+        this->leaderReader.Reset(leaderSocket);
 
         // 2. Handshake.
         if (!this->PerformHandshake(lastAppliedLsn)) {
@@ -146,21 +193,71 @@ sock_t Follower::TryConnect() {
 }
 
 bool Follower::PerformHandshake(uint64_t &myLsn) {
-    // Format: HELLO <nodeId> <lastAppliedLsn>
-    string helloMsg = "HELLO " + std::to_string(this->nodeId) + " " + std::to_string(myLsn) + "\n";
+    // Format: HELLO <nodeId> <lastAppliedLsn> [<protocolVersion> [<lsnBase>]]
+    string helloMsg = "HELLO " + std::to_string(this->nodeId) + " " + std::to_string(myLsn);
+    if (this->helloVersion >= ReplProtocol::BINARY_VERSION) {
+        helloMsg += " " + std::to_string(this->helloVersion);
+    }
+    if (this->helloVersion >= ReplProtocol::SNAPSHOT_VERSION) {
+        // lsnBase parodo leader'iui, ar mūsų LSN priklauso tai pačiai istorijai (kitaip - snapshot'as).
+        helloMsg += " " + std::to_string(this->duombaze->getLsnBase());
+    }
+    helloMsg += "\n";
     if (!send_all(this->currentLeaderSocket, helloMsg)) {
         log_line(LogLevel::WARN, "Failed to send HELLO");
         return false;
     }
 
     log_line(LogLevel::INFO, "Sent HELLO nodeId=" + std::to_string(this->nodeId) + " LSN=" + std::to_string(myLsn));
+
+    // Atsakymas: HELLO kadras (binary protokolas) arba "OK" eilutė (tekstinis).
+    char firstByte = 0;
+    if (!this->leaderReader.Peek(firstByte)) {
+        // Senas leader'is HELLO, kurio nesupranta, atmeta uždarydamas ryšį - tik tada kitą kartą siūlome žemesnę
+        // versiją. Timeout'as ar tinklo klaida apie leader'io versiją nieko nesako.
+        if (this->leaderReader.PeerClosed() && this->helloVersion > ReplProtocol::TEXT_VERSION) {
+            this->helloVersion = (this->helloVersion >= ReplProtocol::SNAPSHOT_VERSION) ? ReplProtocol::BINARY_VERSION
+                                                                                      : ReplProtocol::TEXT_VERSION;
+            log_line(LogLevel::WARN, "Leader rejected HELLO, falling back to protocol version " + std::to_string(this->helloVersion));
+        }
+        return false;
+    }
+
+    if (static_cast<uint8_t>(firstByte) == ReplProtocol::BINARY_VERSION) {
+        if (!recv_repl_frame(this->leaderReader, this->frameHeader, this->framePayload, 0) ||
+            this->frameHeader.type != ReplFrameType::HELLO) {
+            return false;
+        }
+        this->protocolVersion = static_cast<uint8_t>(this->frameHeader.count);
+        this->decompressor.Reset();
+    } else {
+        string okLine;
+        if (!this->leaderReader.ReadLine(okLine)) {
+            return false;
+        }
+        this->protocolVersion = ReplProtocol::TEXT_VERSION;
+    }
+    // Kitas leader'is (failover'is) gali būti naujesnis - po sėkmingo handshake'o vėl siūlome naujausią versiją.
+    this->helloVersion = ReplProtocol::COMPRESSION_VERSION;
+    log_line(LogLevel::INFO, "Replication protocol version " + std::to_string(this->protocolVersion));
     return true;
 }
 
 SessionStatus Follower::RunReplicationSession(uint64_t &myLsn) {
+    if (this->protocolVersion >= ReplProtocol::BINARY_VERSION) {
+        while (this->running &&
+               recv_repl_frame(this->leaderReader, this->frameHeader, this->framePayload, REPLICATION_BATCH_MAX_BYTES)) {
+            if (!this->ProcessFrame(myLsn)) {
+                log_line(LogLevel::ERROR, "Replication protocol error");
+                return SessionStatus::PROTOCOL_ERROR;
+            }
+        }
+        return SessionStatus::CLEAN_DISCONNECT;
+    }
+
     string line;
     try {
-        while (this->running && recv_line(this->currentLeaderSocket, line)) {
+        while (this->running && this->leaderReader.ReadLine(line)) {
             if (!this->ProcessCommandLine(line, myLsn)) {
                 log_line(LogLevel::ERROR, "Replication protocol error");
                 return SessionStatus::PROTOCOL_ERROR;
@@ -198,11 +295,14 @@ bool Follower::ProcessCommandLine(const string &line, uint64_t &myLsn) {
             success = this->ApplySetRecord(tokens, myLsn);
         } else if (command == "DELETE" && tokens.size() >= 3) {
             success = this->ApplyDeleteRecord(tokens, myLsn);
+        } else if (command == "BATCH" && tokens.size() == 3) {
+            success = this->ApplyBatch(tokens, myLsn);
         } else if (command == "RESET_WAL") {
             success = this->ApplyResetWAL(myLsn);
         }
 
-        if (success) {
+        // ACK tik kai įrašas durable mūsų WAL'e. Po BATCH - vienas ACK visam kadrui (kumuliatyvus).
+        if (success && this->duombaze->WaitWalDurable(myLsn)) {
             send_all(this->currentLeaderSocket, "ACK " + std::to_string(myLsn) + "\n");
         }
 
@@ -236,20 +336,13 @@ bool Follower::ApplySetRecord(const vector<string> &tokens, uint64_t &currentLsn
     auto key = string(tokens[2]);
     string value;
 
-    if (!parse_length_prefixed_value(tokens, 3, this->currentLeaderSocket, value)) {
+    if (!parse_length_prefixed_value(tokens, 3, this->leaderReader, value)) {
         FollowerLog(LogLevel::ERROR, "Failed to parse value in WRITE");
         return false;
     }
 
     WalRecord walRecord(lsn, WalOperation::SET, key, value);
-
-    if (!this->duombaze->ApplyReplication(walRecord)) {
-        FollowerLog(LogLevel::ERROR, "Failed to apply replication for LSN " + std::to_string(lsn));
-        return false;
-    }
-
-    currentLsn = lsn;
-    return true;
+    return this->ApplyRecord(walRecord, currentLsn);
 }
 
 bool Follower::ApplyDeleteRecord(const vector<string> &tokens, uint64_t &currentLsn) {
@@ -261,20 +354,271 @@ bool Follower::ApplyDeleteRecord(const vector<string> &tokens, uint64_t &current
     auto key = string(tokens[2]);
 
     WalRecord walRecord(lsn, WalOperation::DELETE, key);
+    return this->ApplyRecord(walRecord, currentLsn);
+}
+
+// Įrašas tik įrašomas į WAL (ACK'as siunčiamas jam tapus durable), medžiui jį pritaiko ApplyLoop.
+bool Follower::ApplyRecord(WalRecord &walRecord, uint64_t &currentLsn) {
+    if (!this->duombaze->LogReplicated(walRecord)) {
+        FollowerLog(LogLevel::ERROR, "Failed to apply replication for LSN " + std::to_string(walRecord.lsn));
+        return false;
+    }
+
+    this->QueueForApply(walRecord);
+    currentLsn = walRecord.lsn;
+    return true;
+}
+
+void Follower::QueueForApply(const WalRecord &walRecord) {
+    size_t recordBytes = ReplProtocol::RECORD_HEADER_SIZE + walRecord.key.size() + walRecord.value.size();
+    {
+        std::unique_lock<std::mutex> lock(this->applyMutex);
+        this->applyQueueChanged.wait(lock, [&] {
+            return this->applyQueueBytes < FOLLOWER_APPLY_QUEUE_BYTES || !this->running;
+        });
+        this->applyQueue.push_back(walRecord);
+        this->applyQueueBytes += recordBytes;
+    }
+    this->applyQueueChanged.notify_all();
+}
+
+// Applier thread'as: ima iki FOLLOWER_APPLY_BATCH_RECORDS įrašų ir pritaiko juos vienu tree lock'u.
+// Sustabdžius follower'į, likę eilėje įrašai dar pritaikomi (jie jau yra WAL'e, tad ir recovery juos pritaikytų).
+void Follower::ApplyLoop() {
+    vector<WalRecord> batch;
+    batch.reserve(FOLLOWER_APPLY_BATCH_RECORDS);
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(this->applyMutex);
+            this->applyQueueChanged.wait(lock, [&] { return !this->applyQueue.empty() || !this->running; });
+            if (this->applyQueue.empty()) {
+                return;
+            }
+
+            batch.clear();
+            while (!this->applyQueue.empty() && batch.size() < FOLLOWER_APPLY_BATCH_RECORDS) {
+                WalRecord &front = this->applyQueue.front();
+                this->applyQueueBytes -= ReplProtocol::RECORD_HEADER_SIZE + front.key.size() + front.value.size();
+                batch.push_back(std::move(front));
+                this->applyQueue.pop_front();
+            }
+            this->applyingBatch = true;
+        }
+        this->applyQueueChanged.notify_all();
+
+        try {
+            this->duombaze->ApplyReplicatedBatch(batch);
+        } catch (const std::exception &ex) {
+            FollowerLog(LogLevel::ERROR, string("[Apply] Failed: ") + ex.what());
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(this->applyMutex);
+            this->applyingBatch = false;
+        }
+        this->applyQueueChanged.notify_all();
+    }
+}
 
-    if (!this->duombaze->ApplyReplication(walRecord)) {
-        FollowerLog(LogLevel::ERROR, "Failed to apply replication for LSN " + std::to_string(lsn));
+// Laukia, kol visi gauti įrašai pritaikyti medžiui (prieš RESET_WAL ir snapshot'o įdiegimą).
+void Follower::WaitApplied() {
+    std::unique_lock<std::mutex> lock(this->applyMutex);
+    this->applyQueueChanged.wait(lock, [&] { return this->applyQueue.empty() && !this->applyingBatch; });
+}
+
+// BATCH <count> <bytes>: po antraštės eina bytes baitų su count WRITE/DELETE eilučių.
+// Kadras perskaitomas visas, todėl per didelis įrašas praleidžiamas neperjungiant ryšio.
+bool Follower::ApplyBatch(const vector<string> &tokens, uint64_t &currentLsn) {
+    size_t count = std::stoull(tokens[1]);
+    size_t bytes = std::stoull(tokens[2]);
+    if (bytes > REPLICATION_BATCH_MAX_BYTES) {
+        FollowerLog(LogLevel::ERROR, "BATCH too big: " + std::to_string(bytes) + " bytes");
+        return false;
+    }
+
+    std::string_view payload;
+    if (!this->leaderReader.ReadExact(bytes, payload)) {
+        return false;
+    }
+
+    size_t position = 0;
+    auto nextToken = [&](char delimiter, string &out) {
+        size_t end = payload.find(delimiter, position);
+        if (end == string::npos) {
+            return false;
+        }
+        out.assign(payload.data() + position, end - position);
+        position = end + 1;
+        return true;
+    };
+
+    for (size_t i = 0; i < count; i++) {
+        string command;
+        string lsnText;
+        string key;
+        if (!nextToken(' ', command) || !nextToken(' ', lsnText)) {
+            FollowerLog(LogLevel::ERROR, "Malformed BATCH record");
+            return false;
+        }
+
+        WalRecord walRecord;
+        walRecord.lsn = std::stoull(lsnText);
+        if (command == "WRITE") {
+            string lengthText;
+            if (!nextToken(' ', key) || !nextToken(' ', lengthText)) {
+                FollowerLog(LogLevel::ERROR, "Malformed WRITE in BATCH");
+                return false;
+            }
+            size_t valueLength = std::stoull(lengthText);
+            if (position + valueLength >= payload.size() || payload[position + valueLength] != '\n') {
+                FollowerLog(LogLevel::ERROR, "Malformed WRITE value in BATCH");
+                return false;
+            }
+            walRecord.operation = WalOperation::SET;
+            walRecord.value.assign(payload.data() + position, valueLength);
+            position += valueLength + 1;
+        } else if (command == "DELETE") {
+            if (!nextToken('\n', key)) {
+                FollowerLog(LogLevel::ERROR, "Malformed DELETE in BATCH");
+                return false;
+            }
+            walRecord.operation = WalOperation::DELETE;
+        } else {
+            FollowerLog(LogLevel::ERROR, "Unknown command in BATCH: " + command);
+            return false;
+        }
+        walRecord.key = std::move(key);
+
+        if (!this->ApplyFramedRecord(walRecord, currentLsn)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Pritaiko kadre atėjusį įrašą. Kadras jau perskaitytas visas, todėl per didelis įrašas tiesiog praleidžiamas.
+bool Follower::ApplyFramedRecord(WalRecord &walRecord, uint64_t &currentLsn) {
+    if (walRecord.lsn <= currentLsn) {
+        return true;
+    }
+    try {
+        return this->ApplyRecord(walRecord, currentLsn);
+    } catch (const std::length_error &ex) {
+        // Žinome, kad blogas įrašas, todėl apsimetame, kad įrašėme.
+        FollowerLog(LogLevel::ERROR, "Skipping LSN " + std::to_string(walRecord.lsn) + ": " + ex.what());
+        currentLsn = walRecord.lsn;
+        return true;
+    }
+}
+
+// Binary protokolo kadras. Po RECORDS / RESET_WAL siunčiamas vienas kumuliatyvus ACK kadras.
+bool Follower::ProcessFrame(uint64_t &myLsn) {
+    if (this->frameHeader.type == ReplFrameType::COMPRESSED &&
+        !repl_decompress_frame(this->frameHeader, this->framePayload, this->decompressor, REPLICATION_BATCH_MAX_BYTES)) {
+        FollowerLog(LogLevel::ERROR, "Malformed COMPRESSED frame");
+        return false;
+    }
+
+    bool success = false;
+    switch (this->frameHeader.type) {
+        case ReplFrameType::RECORDS:
+            success = this->ApplyRecordsFrame(myLsn);
+            break;
+        case ReplFrameType::RESET_WAL:
+            success = this->ApplyResetWAL(myLsn);
+            break;
+        case ReplFrameType::SNAPSHOT_BEGIN:
+            return this->BeginSnapshot();
+        case ReplFrameType::SNAPSHOT_PAGES:
+            return this->WriteSnapshotPages();
+        case ReplFrameType::SNAPSHOT_END:
+            success = this->InstallSnapshot(myLsn);
+            break;
+        default:
+            return true;
+    }
+
+    if (success && this->duombaze->WaitWalDurable(myLsn)) {
+        send_repl_frame(this->currentLeaderSocket, ReplFrameType::ACK, 0, myLsn);
+    }
+    return success;
+}
+
+// RECORDS kadras: įrašai iššifruojami į tą patį frameRecord (be alokacijų kiekvienam įrašui).
+bool Follower::ApplyRecordsFrame(uint64_t &myLsn) {
+    size_t offset = 0;
+    for (uint32_t i = 0; i < this->frameHeader.count; i++) {
+        if (!repl_decode_record(this->framePayload, offset, this->frameRecord)) {
+            FollowerLog(LogLevel::ERROR, "Malformed RECORDS frame");
+            return false;
+        }
+        if (!this->ApplyFramedRecord(this->frameRecord, myLsn)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// SNAPSHOT_BEGIN: mūsų istorijos leader'io WAL'e nebėra. Puslapiai rašomi į atskirą failą, kol jie ateina,
+// skaitymai aptarnaujami iš senos duomenų bazės.
+bool Follower::BeginSnapshot() {
+    this->snapshotLsn = this->frameHeader.lsn;
+    this->snapshotPages = this->frameHeader.count;
+    this->snapshotPagesReceived = 0;
+    if (this->snapshotFile.is_open()) {
+        this->snapshotFile.close();
+    }
+    this->snapshotFile.open(this->duombaze->GetSnapshotInstallPath(), std::ios::binary | std::ios::trunc);
+    if (!this->snapshotFile) {
+        FollowerLog(LogLevel::ERROR, "Cannot create snapshot file " + this->duombaze->GetSnapshotInstallPath().string());
+        return false;
+    }
+    FollowerLog(LogLevel::WARN, "Receiving snapshot from leader: " + std::to_string(this->snapshotPages) +
+                " pages at LSN " + std::to_string(this->snapshotLsn));
+    return true;
+}
+
+// SNAPSHOT_PAGES: count puslapių iš eilės, rašomi tiesiai į failą.
+bool Follower::WriteSnapshotPages() {
+    if (!this->snapshotFile.is_open() ||
+        this->framePayload.size() != static_cast<size_t>(this->frameHeader.count) * Page::PAGE_SIZE ||
+        this->snapshotPagesReceived + this->frameHeader.count > this->snapshotPages) {
+        FollowerLog(LogLevel::ERROR, "Unexpected SNAPSHOT_PAGES frame");
+        return false;
+    }
+    this->snapshotFile.write(this->framePayload.data(), static_cast<std::streamsize>(this->framePayload.size()));
+    if (!this->snapshotFile) {
+        FollowerLog(LogLevel::ERROR, "Failed to write snapshot pages");
+        return false;
+    }
+    this->snapshotPagesReceived += this->frameHeader.count;
+    return true;
+}
+
+// SNAPSHOT_END: snapshot'as pakeičia duomenų bazės failą, WAL tęsiamas nuo snapshot LSN.
+bool Follower::InstallSnapshot(uint64_t &myLsn) {
+    if (!this->snapshotFile.is_open() || this->frameHeader.lsn != this->snapshotLsn ||
+        this->snapshotPagesReceived != this->snapshotPages) {
+        FollowerLog(LogLevel::ERROR, "Incomplete snapshot (" + std::to_string(this->snapshotPagesReceived) + "/" +
+                    std::to_string(this->snapshotPages) + " pages)");
+        return false;
+    }
+    this->snapshotFile.close();
+    this->WaitApplied();
+    if (!this->duombaze->InstallSnapshot(this->snapshotLsn)) {
         return false;
     }
 
-    currentLsn = lsn;
+    myLsn = this->snapshotLsn;
+    FollowerLog(LogLevel::WARN, "Snapshot installed, LSN is now " + std::to_string(myLsn));
     return true;
 }
 
 bool Follower::ApplyResetWAL(uint64_t &localLSN) {
     FollowerLog(LogLevel::WARN, "Received RESET_WAL from Leader. Clearing logs...");
 
-    // 1. RESET!
+    // 1. RESET! (gauti įrašai pirma pritaikomi medžiui)
+    this->WaitApplied();
     this->duombaze->ResetLogState();
 
     // 2. Reset'inam local LSN.
@@ -396,8 +740,9 @@ void Follower::HandleRedirect(sock_t sock) {
 
 void Follower::HandleClient(sock_t clientSocket) {
     try {
+        SocketReader reader(clientSocket);
         string line;
-        while (this->running && recv_line(clientSocket, line)) {
+        while (this->running && reader.ReadLine(line)) {
             auto tokens = split((line), ' ');
             if (tokens.empty()) {
                 continue;
@@ -3,15 +3,9 @@
 #include <algorithm>
 #include <chrono>
 #include <cstddef>
+#include <functional>
 #include <mutex>
 
-namespace CONSTS {
-  static constexpr int TRIES_FOR_COMPACT = 50;
-  static constexpr int SLEEP_BEFORE_CHECKING_NODES = 100;
-
-  static constexpr int COMPACT_INTERVAL = 60;
-}
-
 Leader::Leader(string dbName, uint16_t clientPort, uint16_t followerPort, int requiredAcks, string host)
     :dbName(std::move(dbName)), clientPort(clientPort), followerPort(followerPort), requiredAcks(requiredAcks), host(std::move(host)) {
 
@@ -22,6 +16,9 @@ Leader::Leader(string dbName, uint16_t clientPort, uint16_t followerPort, int re
              " (quorum enforcement: requires " + std::to_string(this->requiredAcks + 1) + "+ nodes)");
 
     this->duombaze = std::make_unique<Database>(this->dbName);
+    this->duombaze->ConfigureWalSync(WAL_SYNC_POLICY,
+                                     std::chrono::microseconds(WAL_GROUP_COMMIT_DELAY_US),
+                                     std::chrono::milliseconds(WAL_SYNC_INTERVAL_MS));
 }
 
 Leader::~Leader() {
@@ -38,10 +35,19 @@ Leader::~Leader() {
     this->followerListenSocket = NET_INVALID;
   }
 
-  this->conditionVariable.notify_all();
+  {
+    std::lock_guard<mutex> lock(this->mtx);
+    for (auto &waiter: this->commitWaiters) {
+      waiter.second->committed.notify_one();
+    }
+  }
+
+  if (this->checkpointThread.joinable()) {
+    this->checkpointThread.join();
+  }
 
-  if (this->compactionThread.joinable()) {
-    this->compactionThread.join();
+  if (this->defragThread.joinable()) {
+    this->defragThread.join();
   }
 
   if (this->followerAcceptThread.joinable()) {
@@ -58,8 +64,11 @@ void Leader::Run() {
   thread announceThread(&Leader::AnnouncePresence, this);
   announceThread.detach(); // // thread'as gyvena iki proceso pabaigos
 
-  // 2. Paleidžiam automatinio sinchronizavimo thread'ą.
-  this->compactionThread = thread(&Leader::AutoCompactLoop, this);
+  // 2. Paleidžiam checkpoint'ų (WAL retention) thread'ą.
+  this->checkpointThread = thread(&Leader::CheckpointLoop, this);
+
+  // 2.1 Paleidžiam lapų defragmentacijos thread'ą.
+  this->defragThread = thread(&Leader::DefragLoop, this);
 
   // 3. Paleidžiam followerių priėmėją atskiram threade
   this->followerAcceptThread = thread(&Leader::AcceptFollowers, this);
@@ -74,27 +83,52 @@ void Leader::Run() {
   }
 }
 
-void Leader::AutoCompactLoop() {
+// Periodiškai daro checkpoint'ą ir trina WAL segmentus, kurių nebereikia nei recovery, nei follower'iams.
+// Rašymai ir skaitymai neblokuojami.
+void Leader::CheckpointLoop() {
   while (this->running) {
-    for (int i = 0; i < CONSTS::COMPACT_INTERVAL; ++i) {
-      if (!this->running) {
-        return;
-      }
-      std::this_thread::sleep_for(std::chrono::seconds(1));
-    }
+    sleep_while_running(CHECKPOINT_INTERVAL_MS, this->running);
 
     if (!this->running) {
-      return;
+      continue;
     }
 
-    log_line(LogLevel::INFO, "[AutoCompact] Triggering scheduled compaction...");
-    string resultMsg;
-    auto success = this->PerformCompaction(resultMsg);
+    try {
+      this->TrimWal();
+    } catch (const std::exception& ex) {
+      log_line(LogLevel::WARN, string("[Checkpoint] Failed: ") + ex.what());
+    }
+  }
+}
+
+// Checkpoint'as ir WAL retention: trinami segmentai iki min(checkpoint LSN, gyvų follower'ių ACK).
+// Neprisijungę follower'iai WAL'o nelaiko - grįžus jų įrašų WAL'e gali nebebūti ir jie gauna snapshot'ą.
+// Snapshot'ą gaunančio follower'io ACK = 0, todėl įrašai po snapshot LSN lieka.
+void Leader::TrimWal() {
+  uint64_t retainAfter = this->duombaze->Checkpoint();
 
-    if (!success) {
-        log_line(LogLevel::WARN, "[AutoCompact] Failed: " + resultMsg);
+  {
+    std::lock_guard<mutex> retentionLock(this->retentionMutex);
+    {
+      std::lock_guard<mutex> lock(this->mtx);
+      for (const auto &follower : this->followers) {
+        if (follower->isAlive) {
+          retainAfter = std::min(retainAfter, follower->ackedUptoLsn);
+        }
+      }
     }
+    this->duombaze->TruncateWal(retainAfter);
+    // Catch-up'ui siunčiama mažiau: perrašyti raktai palieka tik naujausią įrašą.
+    this->duombaze->CompactWal(WAL_COMPACTION_MAX_SEGMENTS);
   }
+  // Atjungti segmentai nulinami be retentionMutex, kad besijungiantis follower'is jų nelauktų.
+  this->duombaze->RecycleWalSegments();
+}
+
+// Background'e po truputį defragmentuoja lapus su daug negyvos vietos (run_defrag_loop).
+void Leader::DefragLoop() {
+  run_defrag_loop(*this->duombaze, this->running,
+                  [](const string &message) { log_line(LogLevel::WARN, message); });
 }
 
 // Paprastas periodinis logas, kad iš logų matytųsi, kuris node yra LEADER.
@@ -136,17 +170,57 @@ void Leader::AcceptFollowers() {
   }
 }
 
+namespace {
+  // Įrašai, siunčiami follower'iui vienu send_all: BINARY_VERSION - vienas RECORDS kadras (COMPRESSION_VERSION - suspaustas),
+  // TEXT_VERSION - WRITE/DELETE eilutės (jas supranta ir seni follower'iai).
+  struct ReplicationBatch {
+    uint8_t  version{ReplProtocol::TEXT_VERSION};
+    string   payload;
+    uint32_t count{0};
+    LzStream *compressor{nullptr}; // sesijos suspaudimo srautas (COMPRESSION_VERSION), kitaip nullptr
+
+    void Add(const WalRecord &walRecord) {
+      if (this->version >= ReplProtocol::BINARY_VERSION) {
+        repl_append_record(this->payload, walRecord);
+      } else {
+        this->payload += (walRecord.operation == WalOperation::SET)
+          ? "WRITE "  + std::to_string(walRecord.lsn) + " " + walRecord.key + " " + format_length_prefixed_value(walRecord.value) + "\n"
+          : "DELETE " + std::to_string(walRecord.lsn) + " " + walRecord.key + "\n";
+      }
+      this->count++;
+    }
+
+    string Frame() {
+      if (this->version < ReplProtocol::BINARY_VERSION) {
+        return this->payload;
+      }
+      string frame;
+      frame.reserve(ReplProtocol::FRAME_HEADER_SIZE + this->payload.size());
+      repl_append_frame(frame, ReplFrameType::RECORDS, this->count, 0, this->payload, this->compressor);
+      return frame;
+    }
+
+    void Clear() {
+      this->payload.clear();
+      this->count = 0;
+    }
+  };
+}
+
 // Kiekvienam follower'iui skirtas thread'as, kuris:
 // 1) Perskaito HELLO <last_lsn> iš follower'io;
-// 2) Nusiunčia jam trūkstamus WAL įrašus;
-// 3) Laukia iš jo ACK pranešimų.
+// 2) Nusprendžia, ar follower'iui reikia snapshot'o (NeedsSnapshot);
+// 3) Paleidžia sender thread'ą (SendToFollower), kuris siunčia snapshot'ą, trūkstamus ir naujus WAL įrašus;
+// 4) Laukia iš jo ACK pranešimų.
 void Leader::HandleFollower(sock_t followerSocket) {
   shared_ptr<FollowerConnection> follower = nullptr;
+  thread sender;
+  SocketReader reader(followerSocket);
 
   try {
     // 1. HELLO iš follower'io.
     string helloLine;
-    if (!recv_line(followerSocket, helloLine)) {
+    if (!reader.ReadLine(helloLine)) {
       net_close(followerSocket);
       return;
     }
@@ -158,8 +232,8 @@ void Leader::HandleFollower(sock_t followerSocket) {
     }
 
     auto helloParts = split(helloLine, ' ');
-    // Naujas formatas: HELLO <nodeId> <lastAppliedLsn>
-    if (helloParts.size() < 2 || helloParts.size() > 3 || helloParts[0] != "HELLO") {
+    // Formatas: HELLO <nodeId> <lastAppliedLsn> [<protocolVersion> [<lsnBase>]] (be versijos - tekstinis protokolas).
+    if (helloParts.size() < 3 || helloParts.size() > 5 || helloParts[0] != "HELLO") {
       log_line(LogLevel::WARN, "Follower sent bad HELLO: " + helloLine);
       net_close(followerSocket);
       return;
@@ -167,18 +241,46 @@ void Leader::HandleFollower(sock_t followerSocket) {
 
     int nodeId = 0;
     uint64_t lastAppliedLsn = 0;
+    uint8_t protocolVersion = ReplProtocol::TEXT_VERSION;
+    bool hasLsnBase = false;
+    uint64_t followerLsnBase = 0;
 
     try {
       nodeId = std::stoi(helloParts[1]);
       lastAppliedLsn = std::stoull(helloParts[2]);
-      log_line(LogLevel::INFO, "Follower HELLO: nodeId=" + std::to_string(nodeId) + " LSN=" + std::to_string(lastAppliedLsn));
+      if (helloParts.size() >= 4) {
+        auto offeredVersion = std::stoul(helloParts[3]);
+        auto supportedVersion = REPLICATION_COMPRESSION ? ReplProtocol::COMPRESSION_VERSION : ReplProtocol::SNAPSHOT_VERSION;
+        protocolVersion = static_cast<uint8_t>(std::min<unsigned long>(offeredVersion, supportedVersion));
+      }
+      if (helloParts.size() == 5) {
+        followerLsnBase = std::stoull(helloParts[4]);
+        hasLsnBase = true;
+      }
+      log_line(LogLevel::INFO, "Follower HELLO: nodeId=" + std::to_string(nodeId) + " LSN=" + std::to_string(lastAppliedLsn) +
+               " protocol=" + std::to_string(protocolVersion));
     } catch (...) {
       log_line(LogLevel::WARN, "Bad format in follower HELLO: " + helloLine);
       net_close(followerSocket);
       return;
     }
 
-    // 2. Find or create connection slot by nodeId
+    // 2. Ar follower'iui trūkstami įrašai dar yra WAL'e. Jei ne, jis gaus snapshot'ą (jei jo protokolas palaiko).
+    // Iki registracijos WAL netrumpinamas (retentionMutex).
+    std::unique_lock<mutex> retentionLock(this->retentionMutex);
+    bool sendSnapshot = this->NeedsSnapshot(lastAppliedLsn, hasLsnBase, followerLsnBase);
+    if (sendSnapshot && protocolVersion < ReplProtocol::SNAPSHOT_VERSION) {
+      // WAL su spraga follower'io būsenos nesugrąžintų - toks ryšys atmetamas, kol follower'is neatnaujintas.
+      log_line(LogLevel::ERROR, "Follower " + std::to_string(nodeId) + " is behind the WAL but can not receive a snapshot (protocol " +
+               std::to_string(protocolVersion) + "), refusing the session");
+      net_close(followerSocket);
+      return;
+    }
+    // Kol snapshot'as nepatvirtintas, follower'io ACK = 0: jis nesiskaito į kvorumą ir WAL po snapshot LSN neištrinamas.
+    uint64_t initialAckedLsn = sendSnapshot ? 0 : lastAppliedLsn;
+
+    // 3. Find or create connection slot by nodeId
+    uint64_t session = 0;
     {
       std::lock_guard<mutex> lock(this->mtx);
 
@@ -193,23 +295,18 @@ void Leader::HandleFollower(sock_t followerSocket) {
         follower = *iterator;
 
         if (follower->followerSocket != NET_INVALID) {
-          net_close(follower->followerSocket);
-          follower->followerSocket = NET_INVALID;
-        }
-
-        if (follower->isAlive) {
-          // Duplicate connection! uždarome seną jungtį ir ją pakeičiama.
-          log_line(LogLevel::WARN, "Node " + std::to_string(nodeId) +
-                   " replacing active connection");
-          if (follower->followerSocket != NET_INVALID) {
-            net_close(follower->followerSocket);
+          // Duplicate connection! Senas ryšys nutraukiamas, jo socket'ą uždaro jo paties thread'as.
+          if (follower->isAlive) {
+            log_line(LogLevel::WARN, "Node " + std::to_string(nodeId) +
+                     " replacing active connection");
           }
+          ::shutdown(follower->followerSocket, SHUT_RDWR);
         }
 
         // Atnaujiname socket'ą ir pažymime kaip gyvą.
         follower->followerSocket = followerSocket;
         follower->isAlive = true;
-        follower->ackedUptoLsn = lastAppliedLsn;
+        follower->ackedUptoLsn = initialAckedLsn;
         follower->lastSeenMs = now_ms();
       } else {
         // Nėra vietos. Kūriame naują.
@@ -217,69 +314,57 @@ void Leader::HandleFollower(sock_t followerSocket) {
         follower->id = nodeId;
         follower->followerSocket = followerSocket;
         follower->isAlive = true;
-        follower->ackedUptoLsn = lastAppliedLsn;
+        follower->ackedUptoLsn = initialAckedLsn;
         follower->lastSeenMs = now_ms();
         this->followers.push_back(follower);
 
         log_line(LogLevel::INFO, "New follower slot created for node " + std::to_string(nodeId));
       }
+      this->UpdateCommitIndex();
+
+      // Nauja siuntimo sesija: trūkstami įrašai pirmiausia skaitomi iš WAL.
+      std::lock_guard<mutex> queueLock(follower->queueMutex);
+      session = ++follower->session;
+      follower->protocolVersion = protocolVersion;
+      follower->sendQueue.clear();
+      follower->queuedBytes = 0;
+      follower->readFromWal = true;
+      follower->sentUptoLsn = lastAppliedLsn;
     }
-
-    if (!send_all(followerSocket, "OK\n")) {
-       log_line(LogLevel::WARN, "Failed to send handshake ACK");
-       {
-        std::lock_guard<mutex> lock(this->mtx);
-        if (follower) {
-          follower->isAlive = false;
-          if (follower->followerSocket != NET_INVALID) {
-            net_close(follower->followerSocket);
-            follower->followerSocket = NET_INVALID;
-          }
-        } else {
-          net_close(followerSocket);
-        }
-       }
-       return;
+    retentionLock.unlock();
+    follower->queueChanged.notify_all();
+
+    bool binary = protocolVersion >= ReplProtocol::BINARY_VERSION;
+    bool handshakeSent = binary
+      ? send_repl_frame(followerSocket, ReplFrameType::HELLO, protocolVersion, this->duombaze->GetWalSequenceNumber())
+      : send_all(followerSocket, "OK\n");
+    if (!handshakeSent) {
+      log_line(LogLevel::WARN, "Failed to send handshake ACK");
+    } else {
+      // 4. Įrašus (ir snapshot'ą) siunčia atskiras thread'as, šis tik skaito ACK.
+      sender = thread(&Leader::SendToFollower, this, follower, followerSocket, session, protocolVersion, sendSnapshot);
     }
 
-    // 3. Persiunčiam follower'iui visus įrašus nuo jo paskutinio turimo LSN.
-    auto missingRecords = this->duombaze->GetWalRecordsSince(lastAppliedLsn);
-    {
-      std::lock_guard<mutex> ioLock(follower->connectionMutex);
-
-      for (const auto &walRecord : missingRecords) {
-      string message = (walRecord.operation == WalOperation::SET)
-          ? ("WRITE "  + std::to_string(walRecord.lsn) + " " + walRecord.key + " " + format_length_prefixed_value(walRecord.value) + "\n")
-          : ("DELETE " + std::to_string(walRecord.lsn) + " " + walRecord.key + "\n");
-
-        if (!send_all(follower->followerSocket, message)) {
-          // Jei siuntimas nepavyksta – nutraukiam šitą follower'į
-          follower->isAlive = false;
-
-          if (follower->followerSocket != NET_INVALID) {
-            net_close(follower->followerSocket);
-            follower->followerSocket = NET_INVALID;
-          }
-          return;
+    // 5. Laukiam ACK.
+    ReplFrameHeader frameHeader;
+    std::string_view framePayload;
+    while (sender.joinable() && follower->isAlive && this->running) {
+      if (binary) {
+        if (!recv_repl_frame(reader, frameHeader, framePayload, 0)) {
+          break;
         }
-    }
-    }
-
-    if (!missingRecords.empty()) {
-      follower->ackedUptoLsn = missingRecords.back().lsn;
-    }
+        if (frameHeader.type == ReplFrameType::ACK) {
+          std::lock_guard<mutex> lock(this->mtx);
+          follower->ackedUptoLsn = std::max(follower->ackedUptoLsn, frameHeader.lsn);
+          follower->lastSeenMs = now_ms();
+          this->UpdateCommitIndex();
+        }
+        continue;
+      }
 
-    // 4. Laukiam ACK.
-    while (follower->isAlive && this->running) {
       string line;
-      if (!recv_line(follower->followerSocket, line)) {
+      if (!reader.ReadLine(line)) {
         // nutrūkęs ryšys / klaida
-        follower->isAlive = false;
-
-        if (follower->followerSocket != NET_INVALID) {
-          net_close(follower->followerSocket);
-          follower->followerSocket = NET_INVALID;
-        }
         break;
       }
 
@@ -287,9 +372,10 @@ void Leader::HandleFollower(sock_t followerSocket) {
       if (tokens.size() == 2 && tokens[0] == "ACK") {
         try {
           uint64_t ackLsn = std::stoull(tokens[1]);
+          std::lock_guard<mutex> lock(this->mtx);
           follower->ackedUptoLsn = std::max(follower->ackedUptoLsn, ackLsn);
           follower->lastSeenMs = now_ms();  // Update'inam kada paskutinį kartą matemę follower'į.
-          this->conditionVariable.notify_all();
+          this->UpdateCommitIndex();
         } catch (...) {
           log_line(LogLevel::WARN, "Bad ACK lsn from follower: " + tokens[1]);
         }
@@ -297,53 +383,267 @@ void Leader::HandleFollower(sock_t followerSocket) {
     }
   } catch (const std::exception& ex) {
     log_line(LogLevel::ERROR, string("Exception in follower_thread: ") + ex.what());
-    if (follower) {
+  } catch (...) {
+    log_line(LogLevel::ERROR, "Unknown exception in follower_thread");
+  }
+
+  // 6. Ryšys baigtas. Vieta pažymima negyva, jei jos dar neperėmė naujas ryšys.
+  if (follower) {
+    std::lock_guard<mutex> lock(this->mtx);
+    if (follower->followerSocket == followerSocket) {
       follower->isAlive = false;
+      follower->followerSocket = NET_INVALID;
+      this->UpdateCommitIndex();
+    }
+  }
 
-      if (follower->followerSocket != NET_INVALID) {
-        net_close(follower->followerSocket);
-        follower->followerSocket = NET_INVALID;
-      } else {
-        net_close(followerSocket);
+  // Sender'is sustabdomas prieš uždarant socket'ą, kad nerašytų į jau kitam ryšiui atiduotą fd.
+  if (sender.joinable()) {
+    {
+      std::lock_guard<mutex> queueLock(follower->queueMutex);
+      follower->queueChanged.notify_all();
+    }
+    ::shutdown(followerSocket, SHUT_RDWR);
+    sender.join();
+  }
+  net_close(followerSocket);
+}
+
+// Follower'io sender thread'as. Siunčia įrašus LSN tvarka: iš sendQueue, o kai eilė perpildyta ar joje trūksta
+// įrašo - iš WAL nuo sentUptoLsn. Baigia darbą, kai ryšys nutrūksta arba follower'is prisijungia iš naujo.
+void Leader::SendToFollower(shared_ptr<FollowerConnection> follower, sock_t followerSocket, uint64_t session,
+                            uint8_t protocolVersion, bool sendSnapshot) {
+  auto active = [&] { return this->running && follower->isAlive && follower->session == session; };
+  auto hasNext = [&] {
+    return !follower->sendQueue.empty() && follower->sendQueue.begin()->first <= follower->sentUptoLsn + 1;
+  };
+
+  // Visi šios sesijos RECORDS / SNAPSHOT_PAGES kadrai suspaudžiami vienu srautu.
+  LzStream compressionStream;
+  LzStream *compressor = (protocolVersion >= ReplProtocol::COMPRESSION_VERSION) ? &compressionStream : nullptr;
+
+  try {
+    if (sendSnapshot && !this->SendSnapshot(*follower, followerSocket, session, compressor)) {
+      ::shutdown(followerSocket, SHUT_RDWR);
+      return;
+    }
+
+    while (true) {
+      ReplicationBatch batch;
+      batch.version = protocolVersion;
+      batch.compressor = compressor;
+      uint64_t lastLsn = 0;
+      bool fromWal = false;
+      {
+        std::unique_lock<mutex> queueLock(follower->queueMutex);
+        follower->queueChanged.wait(queueLock, [&] {
+          return !active() || follower->readFromWal || !follower->sendQueue.empty();
+        });
+        if (!active()) {
+          break;
+        }
+
+        if (!follower->readFromWal && !hasNext()) {
+          // Rašytojai įdeda įrašus ne LSN tvarka. Jei trūkstamas neatsiranda, jis paimamas iš WAL.
+          if (!follower->queueChanged.wait_for(queueLock, std::chrono::milliseconds(FOLLOWER_QUEUE_GAP_MS), [&] {
+                return !active() || follower->readFromWal || hasNext();
+              })) {
+            follower->readFromWal = true;
+          }
+          continue;
+        }
+
+        if (follower->readFromWal) {
+          // WAL turi visus jau įdėtus įrašus (OpenWalReader flush'ina), eilė nebereikalinga.
+          follower->readFromWal = false;
+          follower->sendQueue.clear();
+          follower->queuedBytes = 0;
+          fromWal = true;
+        } else {
+          uint64_t nextLsn = follower->sentUptoLsn + 1;
+          auto iterator = follower->sendQueue.begin();
+          while (iterator != follower->sendQueue.end() && iterator->first <= nextLsn &&
+                 batch.payload.size() < REPLICATION_BATCH_BYTES) {
+            if (iterator->first == nextLsn) {
+              batch.Add(iterator->second);
+              lastLsn = nextLsn++;
+            }
+            follower->queuedBytes -= std::min(follower->queuedBytes,
+                                              iterator->second.key.size() + iterator->second.value.size() + WalFormat::RECORD_HEADER_SIZE);
+            iterator = follower->sendQueue.erase(iterator);
+          }
+        }
+      }
+
+      if (fromWal) {
+        if (!this->SendFromWal(*follower, followerSocket, protocolVersion, compressor)) {
+          break;
+        }
+        continue;
       }
+      if (batch.count == 0) {
+        continue;
+      }
+
+      // Kadras (ir jo suspaudimas) paruošiamas neužrakinus ryšio.
+      string frame = batch.Frame();
+      {
+        std::lock_guard<mutex> ioLock(follower->connectionMutex);
+        if (!send_all(followerSocket, frame)) {
+          log_line(LogLevel::WARN, "Send failed to follower " + std::to_string(follower->id));
+          break;
+        }
+      }
+      follower->sentUptoLsn = lastLsn;
     }
-  } catch (...) {
-    log_line(LogLevel::ERROR, "Unknown exception in follower_thread");
-    if (follower) {
-      follower->isAlive = false;
+  } catch (const std::exception& ex) {
+    log_line(LogLevel::ERROR, string("Exception in follower sender: ") + ex.what());
+  }
 
-      if (follower->followerSocket != NET_INVALID) {
-        net_close(follower->followerSocket);
-        follower->followerSocket = NET_INVALID;
-      } else {
-        net_close(followerSocket);
+  // ACK'ų thread'as pabunda ir uždaro ryšį.
+  ::shutdown(followerSocket, SHUT_RDWR);
+}
+
+// Persiunčia follower'iui WAL įrašus nuo sentUptoLsn (catch-up arba lėtas follower'is).
+// Įrašai skaitomi iš WAL po vieną ir siunčiami iki REPLICATION_BATCH_BYTES dydžio paketais.
+bool Leader::SendFromWal(FollowerConnection &follower, sock_t followerSocket, uint8_t protocolVersion, LzStream *compressor) {
+  WalReader reader = this->duombaze->OpenWalReader(follower.sentUptoLsn);
+
+  ReplicationBatch batch;
+  batch.version = protocolVersion;
+  batch.compressor = compressor;
+  uint64_t lastLsn = 0;
+  WalRecord walRecord;
+  bool hasMore = reader.Next(walRecord);
+  while (hasMore && this->running) {
+    batch.Add(walRecord);
+    lastLsn = walRecord.lsn;
+    hasMore = reader.Next(walRecord);
+
+    if (batch.payload.size() < REPLICATION_BATCH_BYTES && hasMore) {
+      continue;
+    }
+    string frame = batch.Frame();
+    {
+      std::lock_guard<mutex> ioLock(follower.connectionMutex);
+      if (!send_all(followerSocket, frame)) {
+        log_line(LogLevel::WARN, "Catch-up send failed to follower " + std::to_string(follower.id));
+        return false;
       }
     }
+    follower.sentUptoLsn = lastLsn;
+    batch.Clear();
   }
+  return this->running;
 }
 
-// Išsiunčia vieną WAL įrašą visiems aktyviems follower'iams.
-// Naudojama tiek naujiems įrašams (SET/DEL), tiek paleidimo metu replay'inant logbuf.
-void Leader::BroadcastWalRecord(const WalRecord &walRecord) {
-  string message = (walRecord.operation == WalOperation::SET)
-    ? "WRITE " + std::to_string(walRecord.lsn) + " " + walRecord.key + " " + format_length_prefixed_value(walRecord.value) + "\n"
-    : "DELETE " + std::to_string(walRecord.lsn) + " " + walRecord.key + "\n";
+// Ar follower'is gali pasivyti iš WAL. Negali, jei jo istorija kita (kitas lsnBase - pvz. praleistas RESET_WAL ar tuščias
+// follower'is po reset'o), jei jis toliau nei leader'is arba jei dalis jam trūkstamų įrašų jau ištrinta ar suspausta.
+bool Leader::NeedsSnapshot(uint64_t followerLsn, bool hasLsnBase, uint64_t followerLsnBase) {
+  if (hasLsnBase && followerLsnBase != this->duombaze->getLsnBase()) {
+    return true;
+  }
+  if (followerLsn > this->duombaze->GetWalSequenceNumber()) {
+    return true;
+  }
+  return followerLsn + 1 < this->duombaze->GetWalFirstLsn();
+}
 
-  std::lock_guard<mutex> listLock(this->mtx);
+// Siunčia follower'iui puslapių snapshot'ą: SNAPSHOT_BEGIN, SNAPSHOT_PAGES po SNAPSHOT_CHUNK_BYTES, SNAPSHOT_END.
+// Snapshot'as nuoseklus snapshot LSN momentu, rašymai jo metu neblokuojami. Po jo sender'is tęsia iš WAL nuo snapshot LSN.
+bool Leader::SendSnapshot(FollowerConnection &follower, sock_t followerSocket, uint64_t session, LzStream *compressor) {
+  auto snapshot = this->duombaze->OpenSnapshot();
+  uint64_t startedMs = now_ms();
+  log_line(LogLevel::INFO, "Sending snapshot to follower " + std::to_string(follower.id) + ": " +
+           std::to_string(snapshot->PageCount()) + " pages at LSN " + std::to_string(snapshot->Lsn()));
+
+  {
+    std::lock_guard<mutex> ioLock(follower.connectionMutex);
+    if (!send_repl_frame(followerSocket, ReplFrameType::SNAPSHOT_BEGIN, snapshot->PageCount(), snapshot->Lsn())) {
+      return false;
+    }
+  }
 
-  for (auto &follower : this->followers) {
-    if (follower->isAlive) {
-      std::lock_guard<mutex> ioLock(follower->connectionMutex);
+  const uint32_t chunkPages = std::max<uint32_t>(1, SNAPSHOT_CHUNK_BYTES / Page::PAGE_SIZE);
+  string pages;
+  string frame;
+  uint64_t sentBytes = 0;
+  while (true) {
+    if (!this->running || !follower.isAlive || follower.session != session) {
+      return false;
+    }
+    pages.clear();
+    uint32_t count = snapshot->ReadPages(pages, chunkPages);
+    if (count == 0) {
+      break;
+    }
 
-      if (!send_all(follower->followerSocket, message)) {
-        follower->isAlive = false;
-        if (follower->followerSocket != NET_INVALID) {
-          net_close(follower->followerSocket);
-          follower->followerSocket = NET_INVALID;
-        }
-        log_line(LogLevel::WARN, "Broadcast failed to follower");
+    frame.clear();
+    repl_append_frame(frame, ReplFrameType::SNAPSHOT_PAGES, count, 0, pages, compressor);
+    sentBytes += frame.size();
+    std::lock_guard<mutex> ioLock(follower.connectionMutex);
+    if (!send_all(followerSocket, frame)) {
+      log_line(LogLevel::WARN, "Snapshot send failed to follower " + std::to_string(follower.id));
+      return false;
+    }
+  }
+
+  {
+    std::lock_guard<mutex> ioLock(follower.connectionMutex);
+    if (!send_repl_frame(followerSocket, ReplFrameType::SNAPSHOT_END, snapshot->PageCount(), snapshot->Lsn())) {
+      return false;
+    }
+  }
+
+  // Toliau - įrašai po snapshot LSN iš WAL.
+  {
+    std::lock_guard<mutex> queueLock(follower.queueMutex);
+    follower.sendQueue.clear();
+    follower.queuedBytes = 0;
+    follower.readFromWal = true;
+    follower.sentUptoLsn = snapshot->Lsn();
+  }
+
+  uint64_t elapsedMs = std::max<uint64_t>(1, now_ms() - startedMs);
+  uint64_t bytes = static_cast<uint64_t>(snapshot->PageCount()) * Page::PAGE_SIZE;
+  log_line(LogLevel::INFO, "Snapshot sent to follower " + std::to_string(follower.id) + ": " +
+           std::to_string(bytes / (1024 * 1024)) + " MB in " + std::to_string(elapsedMs) + " ms (" +
+           std::to_string(sentBytes / (1024 * 1024)) + " MB sent)");
+  return true;
+}
+
+// Įdeda naują WAL įrašą į kiekvieno gyvo follower'io siuntimo eilę (be tinklo I/O).
+// Perpildyta eilė išvaloma - lėtas follower'is toliau gauna įrašus iš WAL, rašytojai jo nelaukia.
+void Leader::EnqueueForFollowers(const WalRecord &walRecord) {
+  vector<shared_ptr<FollowerConnection>> targets;
+  {
+    std::lock_guard<mutex> listLock(this->mtx);
+    for (const auto &follower : this->followers) {
+      if (follower->isAlive) {
+        targets.push_back(follower);
+      }
     }
+  }
+
+  size_t recordBytes = walRecord.key.size() + walRecord.value.size() + WalFormat::RECORD_HEADER_SIZE;
+  for (const auto &follower : targets) {
+    {
+      std::lock_guard<mutex> queueLock(follower->queueMutex);
+      if (follower->readFromWal || walRecord.lsn <= follower->sentUptoLsn) {
+        continue;
+      }
+      if (follower->queuedBytes + recordBytes > FOLLOWER_SEND_QUEUE_BYTES) {
+        log_line(LogLevel::WARN, "Follower " + std::to_string(follower->id) + " lagging (" +
+                 std::to_string(follower->queuedBytes) + " bytes queued), sending from WAL");
+        follower->sendQueue.clear();
+        follower->queuedBytes = 0;
+        follower->readFromWal = true;
+      } else {
+        follower->sendQueue.emplace(walRecord.lsn, walRecord);
+        follower->queuedBytes += recordBytes;
+      }
     }
+    follower->queueChanged.notify_one();
   }
 }
 
@@ -361,22 +661,64 @@ size_t Leader::CountAcks(uint64_t lsn) {
   return ackCount;
 }
 
-void Leader::WaitForAcks(uint64_t lsn) {
+// Perskaičiuoja commit index ir pažadina rašytojus, kurių LSN jau patvirtintas. Kviečiama laikant mtx,
+// kai pasikeičia follower'io ACK arba jo būsena (prisijungė, atsijungė, reset'as).
+void Leader::UpdateCommitIndex() {
   if (this->requiredAcks <= 0) {
     return;
   }
 
+  this->ackedLsnScratch.clear();
+  for (auto &follower: this->followers) {
+    if (follower->isAlive) {
+      this->ackedLsnScratch.push_back(follower->ackedUptoLsn);
+    }
+  }
+
+  auto quorum = static_cast<size_t>(this->requiredAcks);
+  if (this->ackedLsnScratch.size() < quorum) {
+    this->commitLsn = 0;
+    return;
+  }
+  std::nth_element(this->ackedLsnScratch.begin(), this->ackedLsnScratch.begin() + static_cast<ptrdiff_t>(quorum - 1),
+                   this->ackedLsnScratch.end(), std::greater<>());
+  this->commitLsn = this->ackedLsnScratch[quorum - 1];
+
+  auto committedEnd = this->commitWaiters.upper_bound(this->commitLsn);
+  for (auto waiter = this->commitWaiters.begin(); waiter != committedEnd; ++waiter) {
+    waiter->second->done = true;
+    waiter->second->committed.notify_one();
+  }
+  this->commitWaiters.erase(this->commitWaiters.begin(), committedEnd);
+}
+
+// Laukia (iki 3s), kol lsn patvirtins requiredAcks follower'ių. Grąžina true, jei patvirtino.
+bool Leader::WaitForAcks(uint64_t lsn) {
+  if (this->requiredAcks <= 0) {
+    return true;
+  }
+
   std::unique_lock<mutex> lock(this->mtx);
-  this->conditionVariable.wait_for(lock, std::chrono::seconds(3), [&]{
-      return this->CountAcks(lsn) >= static_cast<size_t>(this->requiredAcks);
+  if (this->commitLsn >= lsn) {
+    return true;
+  }
+
+  CommitWaiter waiter;
+  auto position = this->commitWaiters.emplace(lsn, &waiter);
+  waiter.committed.wait_for(lock, std::chrono::seconds(3), [&]{
+      return waiter.done || !this->running;
   });
+  if (!waiter.done) {
+    this->commitWaiters.erase(position);
+  }
+  return waiter.done;
 }
 
 // Klausosi klientų (SET/GET/DEL) nurodytame porte ir tvarko jų užklausas.
 // Visi SET/DEL:
 //  - įrašomi į WAL failą
 //  - įrašomi į B+ medį
-//  - išsiunčiami follower'iams (broadcastWalRecord)
+//  - įdedami į follower'ių siuntimo eiles (EnqueueForFollowers)
 //  - jei REQUIRED_ACKS > 0, laukiama ACK'ų iš follower'ių
 void Leader::ServeClients() {
   sock_t listenSocket = tcp_listen(this->clientPort);
@@ -399,7 +741,7 @@ void Leader::ServeClients() {
   }
 }
 
-void Leader::HandleSet(sock_t clientSocket, const vector<string> &tokens) {
+void Leader::HandleSet(sock_t clientSocket, SocketReader &reader, const vector<string> &tokens) {
   // Tikriname Quarum'ą prieš priimant WRITE operacijas.
   if (!HasQuorum()) {
     send_all(clientSocket, "ERR_NO_QUORUM Insufficient nodes for write operation (need 3+ nodes)\n");
@@ -411,7 +753,7 @@ void Leader::HandleSet(sock_t clientSocket, const vector<string> &tokens) {
   auto key = string(tokens[1]);
   string value;
 
-  if (!parse_length_prefixed_value(tokens, 2, clientSocket, value)) {
+  if (!parse_length_prefixed_value(tokens, 2, reader, value)) {
     send_all(clientSocket, "ERR_INVALID_VALUE_FORMAT\n");
     return;
   }
@@ -423,12 +765,16 @@ void Leader::HandleSet(sock_t clientSocket, const vector<string> &tokens) {
   if (newLsn > 0) {
     walRecord.lsn = newLsn;
 
-    this->BroadcastWalRecord(walRecord);
-    this->WaitForAcks(newLsn);
+    // Follower'iai rašo lygiagrečiai su mūsų fdatasync.
+    this->EnqueueForFollowers(walRecord);
+    if (!this->duombaze->WaitWalDurable(newLsn)) {
+      send_all(clientSocket, "ERR_WAL_SYNC_FAILED\n");
+      return;
+    }
 
     // Patvirtiname, kad gavome užtektinai ACK iš Quarum'o.
-    size_t actualAcks = this->CountAcks(newLsn);
-    if (actualAcks < static_cast<size_t>(this->requiredAcks)) {
+    if (!this->WaitForAcks(newLsn)) {
+      size_t actualAcks = this->CountAcks(newLsn);
       log_line(LogLevel::ERROR, "SET operation failed: insufficient ACKs (got " +
                std::to_string(actualAcks) + ", need " + std::to_string(this->requiredAcks) + ")");
       send_all(clientSocket, "ERR_INSUFFICIENT_ACKS Replication failed (got " +
@@ -458,12 +804,15 @@ void Leader::HandleDel(sock_t clientSocket, const vector<string> &tokens) {
   if (newLsn > 0) {
     walRecord.lsn = newLsn;
 
-    this->BroadcastWalRecord(walRecord);
-    this->WaitForAcks(newLsn);
+    this->EnqueueForFollowers(walRecord);
+    if (!this->duombaze->WaitWalDurable(newLsn)) {
+      send_all(clientSocket, "ERR_WAL_SYNC_FAILED\n");
+      return;
+    }
 
     // Patvirtiname, kad gavome užtektinai ACK iš Quarum'o.
-    size_t actualAcks = this->CountAcks(newLsn);
-    if (actualAcks < static_cast<size_t>(this->requiredAcks)) {
+    if (!this->WaitForAcks(newLsn)) {
+      size_t actualAcks = this->CountAcks(newLsn);
       log_line(LogLevel::ERROR, "DEL operation failed: insufficient ACKs (got " +
                std::to_string(actualAcks) + ", need " + std::to_string(this->requiredAcks) + ")");
       send_all(clientSocket, "ERR_INSUFFICIENT_ACKS Replication failed (got " +
@@ -548,30 +897,15 @@ void Leader::HandleGetKeysPaging(sock_t clientSocket, const vector<string>& toke
   }
 }
 
+// COMPACT: checkpoint'as ir WAL retention iš karto, nelaukiant CHECKPOINT_INTERVAL_MS. Klientai neblokuojami.
 void Leader::HandleCompact(sock_t clientSocket) {
-  string msg;
-  bool success = this->PerformCompaction(msg);
-
-  send_all(clientSocket, msg + "\n");
-}
-
-bool Leader::IsClusterHealthy() {
-  std::lock_guard<mutex> lock(this->mtx);
-
-  // 1. CLUSTER dydis iš rules.hpp.
-  int totalNodesInConfig = sizeof(CLUSTER) / sizeof(NodeInfo);
-
-  // 2. Reikalingi (Total - 1), nes lyderis nesiskaičiuoja.
-  int requiredFollowers = totalNodesInConfig - 1;
-
-  int activeFollowers = 0;
-  for (auto &follower : this->followers) {
-    if (follower->isAlive) {
-      activeFollowers++;
-    }
+  try {
+    this->TrimWal();
+    send_all(clientSocket, "OK_COMPACTED\n");
+  } catch (const std::exception& ex) {
+    log_line(LogLevel::WARN, string("COMPACT failed: ") + ex.what());
+    send_all(clientSocket, "ERR " + string(ex.what()) + "\n");
   }
-
-  return activeFollowers >= requiredFollowers;
 }
 
 int Leader::CountAliveFollowers() {
@@ -591,106 +925,19 @@ bool Leader::HasQuorum() {
     return CountAliveFollowers() >= 2;
 }
 
-void Leader::BroadcastReset() {
-  log_line(LogLevel::INFO, "Broadcasting RESET_WAL to followers...");
-
-  std::lock_guard<mutex> listLock(this->mtx);
-
-  for (auto &follower: this->followers) {
-    if (follower->isAlive) {
-      std::lock_guard<mutex> ioLock(follower->connectionMutex);
-
-      // Siunčiame komandą.
-      if (!send_all(follower->followerSocket, "RESET_WAL\n")) {
-        log_line(LogLevel::WARN, "Failed to send RESET_WAL to a follower");
-        follower->isAlive = false;
-        if (follower->followerSocket != NET_INVALID) {
-          net_close(follower->followerSocket);
-          follower->followerSocket = NET_INVALID;
-        }
-      }
-    }
-  }
-}
-
-bool Leader::PerformCompaction(string &statusMsg) {
-  log_line(LogLevel::INFO, "Attempting Compaction...");
-
-  // 1. Tikriname ar visos egzistuojančios replikacijos gyvos.
-  if (!this->IsClusterHealthy()) {
-    statusMsg = "ERR_CLUSTER_NOT_FULL_CANNOT_COMPACT";
-    log_line(LogLevel::WARN, "Compaction aborted: Cluster not full.");
-    return false;
-  }
-
-  // 2. Stabdome pasaulį.
-  this->maintenanceMode = true;
-  log_line(LogLevel::WARN, "--- STOP THE WORLD: MAINTENANCE STARTED ---");
-
-  // 3. Laukiame kol visi follower'iai susisinchronizuos pagal lyderio LSN.
-  auto currentLSN = this->duombaze->getLSN();
-  log_line(LogLevel::INFO, "Waiting for followers to catch up to LSN: " + std::to_string(currentLSN));
-
-  bool allSynced = false;
-  for (int i = 0; i < CONSTS::TRIES_FOR_COMPACT; i++) {
-    int syncedCount = 0;
-    {
-      std::lock_guard<mutex> lock(this->mtx);
-      for (auto &follower: this->followers) {
-        if (follower->isAlive && follower->ackedUptoLsn >= currentLSN) {
-          syncedCount++;
-        }
-      }
-    }
-
-    if (syncedCount >= ((sizeof(CLUSTER)/sizeof(NodeInfo)) - 1)) {
-      allSynced = true;
-      break;
-    }
-    std::this_thread::sleep_for(std::chrono::milliseconds(CONSTS::SLEEP_BEFORE_CHECKING_NODES));
-  }
-
-  if (!allSynced) {
-    this->maintenanceMode = false;
-    statusMsg = "ERR_TIMEOUT_WAITING_FOR_SYNC";
-    log_line(LogLevel::ERROR, "Compaction failed: Timeout waiting for followers.");
-    return false;
-  }
-
-  // 4. Jeigu viskas OK, tai Broadcast'iname kiekvienam follower'iui, kad reset'intų WAL.
-  this->BroadcastReset();
-
-  // 5. Laukiame, kol visi follower'iai atsakys.
-  std::this_thread::sleep_for(std::chrono::seconds(2));
-
-  // 6. Pats (lyderis) reset'ina WAL.
-  log_line(LogLevel::INFO, "Resetting LEADER logs...");
-  this->duombaze->ResetLogState();
-
-  // 7. Pasaulis vėl sukasi.
-  this->maintenanceMode = false;
-  statusMsg = "OK_COMPACTED\n";
-  log_line(LogLevel::INFO, "--- COMPACTION SUCCESSFUL ---");
-  return true;
-}
-
 void Leader::HandleClient(sock_t clientSocket) {
   try {
+    SocketReader reader(clientSocket);
     string requestLine;
-    while (this->running && recv_line(clientSocket, requestLine)) {
+    while (this->running && reader.ReadLine(requestLine)) {
       auto tokens = split(trim(requestLine), ' ');
       if (tokens.empty()) {
         continue;
       }
 
       string &command = tokens[0];
-      if (this->maintenanceMode && command != "COMPACT") {
-        send_all(clientSocket, "ERR_MAINTENANCE_MODE_TRY_LATER\n");
-        continue;
-      }
-
       if (command == "SET" && tokens.size() >= 4) {
-        this->HandleSet(clientSocket, tokens);
+        this->HandleSet(clientSocket, reader, tokens);
       } else if (command == "DEL" && tokens.size() == 2) {
         this->HandleDel(clientSocket, tokens);
       } else if (command == "GET" && tokens.size() >= 2) {
@@ -711,6 +958,7 @@ void Leader::HandleClient(sock_t clientSocket) {
         std::ostringstream response;
         std::lock_guard<mutex> lock(this->mtx);
         uint64_t currentTime = now_ms();
+        uint64_t leaderLsn = this->duombaze->GetWalSequenceNumber();
 
         for (auto& follower : this->followers) {
           bool recentlySeen = (currentTime - follower->lastSeenMs) < FOLLOWER_STATUS_CACHE_MS;
@@ -722,10 +970,20 @@ void Leader::HandleClient(sock_t clientSocket) {
           // Report actual connection state, but show "recently seen" followers
           const string status = follower->isAlive ? "ALIVE" : "RECENT";
 
+          // Lag'as: kiek įrašų follower'is dar nepatvirtino ir kiek baitų laukia jo siuntimo eilėje.
+          uint64_t lagLsn = leaderLsn > follower->ackedUptoLsn ? leaderLsn - follower->ackedUptoLsn : 0;
+          size_t queuedBytes = 0;
+          {
+            std::lock_guard<mutex> queueLock(follower->queueMutex);
+            queuedBytes = follower->queuedBytes;
+          }
+
           response << "FOLLOWER_STATUS "
                    << follower->id << " "
                    << status << " "
-                   << follower->ackedUptoLsn << "\n";
+                   << follower->ackedUptoLsn << " "
+                   << lagLsn << " "
+                   << queuedBytes << "\n";
         }
         response << "END\n";
         send_all(clientSocket, response.str());
@@ -95,11 +95,11 @@ static string my_db_name() {
 // Apskaičiuoja paskutinį seq šio node'o loge
 // Reads LSN from Database metapage instead of WAL files
 // This ensures correct LSN even after Optimize() which deletes WAL files
+// Database nekonstruojam: jis paleistų WAL recovery ant gyvo leader/follower proceso failų.
 static uint64_t compute_my_last_seq() {
     try {
         // Read LSN from database metapage (always persisted)
-        Database duombaze(my_db_name());
-        return duombaze.getLSN();
+        return Database::ReadStoredLSN(my_db_name());
     } catch (...) {
         return 0;
     }
@@ -211,8 +211,9 @@ static void stop_process(Child& child) {
 // (HB, VOTE_REQ, VOTE_RESP) tarp run procesų.
 static void handle_conn(sock_t client_socket) {
   try {
+    SocketReader reader(client_socket);
     string line;
-    if (!recv_line(client_socket, line)) { net_close(client_socket); return; }
+    if (!reader.ReadLine(line)) { net_close(client_socket); return; }
     auto tokens = split(trim(line), ' ');
     if (tokens.empty()) { net_close(client_socket); return; }
 
@@ -380,8 +381,9 @@ static void handle_conn(sock_t client_socket) {
           send_all(leader_sock, "INTERNAL_FOLLOWER_STATUS\n");
 
           // Read follower status lines
+          SocketReader leaderReader(leader_sock);
           string follower_line;
-          while (recv_line(leader_sock, follower_line)) {
+          while (leaderReader.ReadLine(follower_line)) {
             follower_line = trim(follower_line);
             if (follower_line == "END") {
               break;
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief CRC32C (Castagnoli polynomial). Used for WAL record checksums.
+ *
+ * @param data bytes to checksum
+ * @param length number of bytes
+ * @param crc previous crc, to continue checksum over several buffers
+ * @return crc32c of data
+ */
+uint32_t Crc32c(const void *data, size_t length, uint32_t crc = 0);
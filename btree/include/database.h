@@ -7,6 +7,9 @@
 #include <cstdint>
 #include <string>
 #include <filesystem>
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
 
 class Page;
 class BasicPage;
@@ -17,6 +20,62 @@ namespace fs = std::filesystem;
 
 static constexpr std::size_t MAX_KEY_LENGTH = 255;
 static constexpr std::size_t MAX_VALUE_LENGTH = 2048;
+// Share of bytes kept in the left leaf when a split is caused by appending past the leaf's last key
+// (clamped so the right leaf always fits the appended cell)
+static constexpr double APPEND_SPLIT_RATIO = 0.9;
+
+/**
+ * @brief Cached descent to the rightmost leaf, so append-only inserts (increasing keys) skip the internal pages.
+ * Keys greater than fenceKey (or any key when hasFenceKey is false) belong to leafID.
+ */
+struct RightmostLeafCache {
+    bool valid = false;
+    uint32_t leafID = 0;
+    bool hasFenceKey = false;
+    string fenceKey;
+    vector<uint32_t> path;
+};
+
+// Result of one background defragmentation step
+struct defragResult {
+    uint32_t pagesVisited;
+    uint32_t pagesDefragmented;
+    bool passFinished; // reached the last leaf, next call starts from the first one
+};
+
+/**
+ * @brief Point-in-time copy of the database file as of Lsn(), read page by page to bootstrap a follower.
+ * Writes are not blocked: before a writer overwrites a page the snapshot has not read yet, the old page is copied
+ * to a side file (<db>.preimage<n>). Pages are read in chunks under the shared tree lock. Created by Database::OpenSnapshot.
+ */
+class PageSnapshot {
+    friend class Database;
+public:
+    ~PageSnapshot();
+    PageSnapshot(const PageSnapshot &) = delete;
+    PageSnapshot &operator=(const PageSnapshot &) = delete;
+
+    uint64_t Lsn() const { return lsn; }
+    uint32_t PageCount() const { return pageCount; }
+    uint32_t ReadPages(string &out, uint32_t maxPages);
+
+private:
+    Database *database;
+    uint64_t lsn{0};
+    uint32_t pageCount{0};    // meta page + pages 1..lastPageID when the snapshot was taken
+    uint32_t nextPage{0};     // pages below it are already read
+    string metaPage;          // meta page as of lsn, checkpointLSN = lsn
+    int databaseFd{-1};       // database file as of lsn, stays readable if Optimize replaces the file
+    bool fileReplaced{false}; // pages in databaseFd no longer change, nothing to preserve
+    bool failed{false};       // an old page could not be preserved
+    fs::path preImagePath;
+    int preImageFd{-1};
+    std::unordered_map<uint32_t, uint64_t> preImageOffsets;
+    uint64_t preImageSize{0};
+
+    explicit PageSnapshot(Database *database) : database(database) {}
+    void PreserveOldPage(uint32_t pageID);
+};
 
 /**
  * @brief Main Database class. Has all of the functionality methods (get, set, remove)
@@ -24,6 +83,7 @@ static constexpr std::size_t MAX_VALUE_LENGTH = 2048;
  *
  */
 class Database {
+    friend class PageSnapshot;
 private:
     string name;
     fs::path pathToDatabaseFile;
@@ -31,18 +91,40 @@ private:
     WAL wal;
     bool RecoverFromWal();
 
+    // Readers share the tree, writers (and defragmentation) take it exclusively
+    mutable std::shared_mutex treeMutex;
+
+    RightmostLeafCache rightmostLeaf;
+    uint32_t defragCursor = 0; // next leaf to check in DefragmentLeaves (0 - start from the first leaf)
+
+    // Snapshots being read (OpenSnapshot), changed under the exclusive tree lock
+    vector<PageSnapshot *> activeSnapshots;
+    uint64_t snapshotCounter = 0;
+
     // Page operations
     Page ReadPage(uint32_t pageID) const;
     MetaPage ReadMetaPage() const;
     bool WriteBasicPage(BasicPage &PageToWrite) const;
     bool UpdateMetaPage(MetaPage &PageToWrite) const;
-    void SplitLeafPage(LeafPage &LeafToSplit);
-    void SplitInternalPage(InternalPage &InternalToSplit);
+    bool SplitLeafPage(LeafPage &LeafToSplit, const string &key, const string &value, vector<uint32_t> &path, MetaPage &Meta, uint64_t pageLSN);
+    void SplitInternalPage(InternalPage &InternalToSplit, string &key, uint32_t &leftChildID, uint32_t &rightChildID, MetaPage &Meta, uint64_t pageLSN);
+    void InsertIntoParent(vector<uint32_t> &path, string key, uint32_t leftChildID, uint32_t rightChildID, MetaPage &Meta, uint64_t pageLSN);
+
+    // Tree changes without locking, lsn != 0 stamps pages and meta page
+    bool ApplySet(const string &key, const string &value, uint64_t lsn);
+    bool ApplyRemove(const string &key, uint64_t lsn);
+    uint64_t GetLeafPageLSN(const string &key) const;
+
+    void SyncDatabaseFile() const;
+    void DetachSnapshots();
 
     public:
     // Constructor
     explicit Database(const string &name);
 
+    // LSN from the meta page of an existing database file (no WAL, no recovery)
+    static uint64_t ReadStoredLSN(const string &name);
+
     // Accessors
     string getName() const;
     fs::path getPath() const;
@@ -59,22 +141,44 @@ private:
     vector<leafNodeCell> GetFB(const string &key, uint32_t n) const;
     bool Remove(const string& key);
     void Optimize();
+    defragResult DefragmentLeaves(double deadRatio, uint32_t pageBudget);
 
     // methods for getting/writing lsn to metapage
     uint64_t getLSN();
+    uint64_t getLsnBase();
     bool writeLSN(uint64_t LSNToWrite);
 
     // Wrapper metodai WAL metodams, kad būtų patogiau koduot.
     uint64_t ExecuteLogSetWithLSN(const string &key, const string &value);
     uint64_t ExecuteLogDeleteWithLSN(const string &key);
 
-    bool ApplyReplication(WalRecord walRecord);
+    // Follower replication pipeline: the receiver logs records (and ACKs them once durable),
+    // the applier thread applies them to the tree in batches
+    bool LogReplicated(WalRecord &walRecord);
+    size_t ApplyReplicatedBatch(const vector<WalRecord> &records);
 
     uint64_t GetWalSequenceNumber() const { return wal.GetCurrentSequenceNumber(); }
+    uint64_t GetWalFirstLsn();
 
-    vector<WalRecord> GetWalRecordsSince(uint64_t lastKnownLsn);
+    WalReader OpenWalReader(uint64_t lastKnownLsn);
     void ResetLogState();
 
+    // WAL durability (group commit)
+    bool WaitWalDurable(uint64_t lsn);
+    void ConfigureWalSync(WalSyncPolicy policy, std::chrono::microseconds groupDelay, std::chrono::milliseconds interval);
+
+    // Checkpoint and WAL retention
+    uint64_t Checkpoint();
+    bool TruncateWal(uint64_t upToLsn);
+    void RecycleWalSegments();
+    size_t CompactWal(size_t maxSegments);
+
+    // Follower bootstrap: the leader streams a snapshot of its pages, the follower writes them to
+    // GetSnapshotInstallPath() and installs the file
+    std::unique_ptr<PageSnapshot> OpenSnapshot();
+    fs::path GetSnapshotInstallPath() const;
+    bool InstallSnapshot(uint64_t snapshotLsn);
+
     // For Debug
     void CoutDatabase() const;
 
@@ -2,6 +2,12 @@
 
 #include "page.h"
 
+/**
+ * @brief Result of LeafPage::InsertKeyValue
+ *
+ */
+enum class InsertResult : uint8_t { INSERTED, UPDATED, NO_SPACE };
+
 /**
  * @brief LeafPage class for leaf nodes in b+tree. Stores key:value pairs.
  * Special1 stores pointer to previous leaf. Special2 stores pointer to next leaf
@@ -19,13 +25,16 @@ class LeafPage : public BasicPage {
         uint16_t FindInsertPosition(const string& key);
         int16_t FindKeyIndex(const string& key);
         bool WillFit(const string &key, const string &value);
+        bool WillFitAfterOptimize(const string &key, const string &value);
         LeafPage Optimize();
 
         // Operations
-        bool InsertKeyValue(string key, string value);
+        InsertResult InsertKeyValue(const string &key, const string &value);
         leafNodeCell GetKeyValue(uint16_t offset);
+        std::string_view GetKey(uint16_t offset);
         std::optional<leafNodeCell> FindKey(const string &key);
-        void RemoveKey(const string &key);
+        bool RemoveKey(const string &key);
+        void WriteCell(uint16_t offset, const string &key, const string &value);
 
         // For debug
         void CoutPage();
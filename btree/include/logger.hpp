@@ -1,7 +1,18 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
 #include <fstream>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
+#include <thread>
 #include <vector>
 #include <filesystem>
 
@@ -14,6 +25,27 @@ namespace fs = std::filesystem;
 */
 enum class WalOperation : uint8_t { SET, DELETE };
 
+/**
+ * @brief Binary WAL segment layout.
+ * Segment starts with MAGIC + uint32 VERSION, followed by records:
+ * crc32c(4) | lsn(8) | operation(1) | keyLength(2) | valueLength(4) | key | value
+ * CRC covers everything after the crc field. Segments without MAGIC are old text segments (lsn|SET|key|value lines).
+ * Segment files are preallocated (and recycled), so the logical end is marked by END_MARKER_SIZE zero bytes.
+ */
+namespace WalFormat {
+    static constexpr char MAGIC[4] = {'W', 'A', 'L', 'B'};
+    static constexpr uint32_t VERSION = 1;
+    static constexpr size_t SEGMENT_HEADER_SIZE = 8;
+    static constexpr size_t RECORD_HEADER_SIZE = 19;
+    static constexpr size_t FIRST_RECORD_READ_SIZE = 64UL * 1024UL; // enough for the first record of any segment
+    static constexpr size_t END_MARKER_SIZE = RECORD_HEADER_SIZE;   // zero bytes after the last record (lsn 0 never decodes)
+}
+
+/**
+ * @brief Result of decoding one binary WAL record
+ */
+enum class WalDecodeStatus : uint8_t { OK, INCOMPLETE, CORRUPT };
+
 /**
  * @brief Struct for WAL record.
  *
@@ -28,52 +60,230 @@ struct WalRecord {
     WalRecord(uint64_t seqNum, WalOperation operation, string key, string value = "");
 };
 
+/**
+ * @brief When WAL records become durable (fdatasync).
+ * PER_COMMIT - appender thread writes and syncs records as soon as they are queued
+ * GROUP - appender thread collects records for up to groupCommitDelay and writes + syncs them together
+ * INTERVAL - appender thread syncs every syncInterval, writers do not wait for durability
+ */
+enum class WalSyncPolicy : uint8_t { PER_COMMIT, GROUP, INTERVAL };
+
+/**
+ * @brief One slot of the WAL ring. sequence == lsn: free for lsn, lsn + 1: holds encoded record lsn.
+ */
+struct WalRingSlot {
+    std::atomic<uint64_t> sequence{0};
+    string bytes;
+};
+
+/**
+ * @brief Sparse LSN index of one segment: first/last LSN and (lsn, byte offset) of a record every INDEX_INTERVAL_BYTES.
+ * Lets ReadFrom skip segments below the requested LSN and seek inside the first segment it needs.
+ */
+struct WalSegmentIndex {
+    static constexpr size_t INDEX_INTERVAL_BYTES = 64UL * 1024UL;
+
+    uint64_t firstLsn{0};
+    uint64_t lastLsn{0};
+    bool textFormat{false}; // old text segment, offsets are not kept
+    bool firstLsnOnly{false}; // segment not scanned since WAL was opened, only firstLsn is known
+    vector<std::pair<uint64_t, size_t>> offsets;
+
+    void Add(uint64_t lsn, size_t offset);
+};
+
+/**
+ * @brief Segment a WalReader will read
+ */
+struct WalReaderSegment {
+    fs::path path;
+    size_t startOffset;  // from the segment index
+    uint64_t fileId;     // inode when startOffset was taken; a file replaced by compaction is read from the start
+    vector<size_t> chunkOffsets; // parallel decoding: indexed record offsets splitting the rest into ~DECODE_CHUNK_BYTES parts
+};
+
+/**
+ * @brief Records one parallel decoding task read from a segment (WalReader::DecodeChunk)
+ */
+struct WalDecodedChunk {
+    vector<WalRecord> records;
+    WalReaderSegment next;       // where the segment continues (path, fileId, startOffset)
+    bool continueReading{false}; // tail of the segment, not read to the end yet
+};
+
+/**
+ * @brief Reads WAL records with LSN > afterLsn one at a time, segment by segment, through a READ_BUFFER_SIZE buffer.
+ * Memory use does not depend on how many records are read. Created by WAL::OpenReader.
+ * With parallelSegments > 1, up to that many upcoming chunks (DECODE_CHUNK_BYTES of a segment, split at indexed
+ * record offsets) are decoded on worker threads while the caller consumes the current one, so memory stays bounded;
+ * the tail of a segment is read in chunks one after another. Records are still returned in LSN order. Records at or
+ * below the last returned LSN are skipped, so a segment compacted while being read does not repeat records.
+ */
+class WalReader {
+    friend class WAL;
+public:
+    static constexpr size_t READ_BUFFER_SIZE = 256UL * 1024UL;
+    static constexpr size_t DECODE_CHUNK_BYTES = 1024UL * 1024UL; // segment bytes one decoding task reads
+    static constexpr size_t MAX_PARALLEL_SEGMENTS = 8; // decoding tasks in flight, each holds ~2x DECODE_CHUNK_BYTES
+
+    static size_t DefaultParallelism();
+    bool Next(WalRecord &record);
+
+private:
+    vector<WalReaderSegment> segments;
+    std::shared_mutex *segmentFilesMutex{nullptr}; // WAL::segmentFilesMutex, held while a segment is opened
+    size_t nextSegment{0};
+    uint64_t afterLsn{0};
+    std::ifstream segmentFile;
+    bool textSegment{false};
+    uint64_t segmentLastLsn{0}; // LSN must grow within a segment, a lower one ends it (ReadSegment does the same)
+    string buffer;
+    size_t bufferPosition{0};
+
+    // Parallel decoding
+    size_t parallelSegments{1};
+    size_t nextChunk{0}; // chunk of segments[nextSegment] to start decoding next
+    std::deque<std::future<WalDecodedChunk>> decodingChunks;
+    vector<WalRecord> decodedRecords;
+    size_t decodedPosition{0};
+
+    WalReader(vector<WalReaderSegment> segments, std::shared_mutex *segmentFilesMutex, uint64_t afterLsn, size_t parallelSegments);
+    bool OpenNextSegment();
+    bool FillBuffer();
+    bool NextDecoded(WalRecord &record);
+    void StartDecoding();
+    std::future<WalDecodedChunk> DecodeChunk(const fs::path &segmentPath, uint64_t fileId, size_t startOffset, size_t maxBytes,
+                                             bool tail) const;
+};
+
 /**
  * @brief Struct for WAL.
- *
+ * Writers reserve an LSN with one atomic increment, encode the record and publish it into ring slot lsn % RING_CAPACITY
+ * (lock-free, bounded MPSC). A single appender thread drains the ring in LSN order, rotates segments and writes
+ * each group with one write + fdatasync, then publishes durableLsn.
+ * ioMutex is held by the appender while it writes, and by ClearAll / rebase, which need an empty ring.
  */
 class WAL {
     friend class Database;
+    friend class WalReader;
 private:
+    static constexpr uint64_t RING_CAPACITY = 4096; // power of two
+    static constexpr uint8_t APPENDER_RUNNING = 0;
+    static constexpr uint8_t APPENDER_IDLE = 1;     // waiting for the first record
+    static constexpr uint8_t APPENDER_GROUPING = 2; // waiting for more records of the group
+
     string name;
     fs::path walDirectory;
-    fs::path currentWalPath;
-    std::fstream walFile;
-    uint64_t currentSequenceNumber;
-    uint64_t currentSegmentNumber;
+    std::atomic<uint64_t> currentSegmentNumber{0};
     size_t maxSegmentSize;
-    size_t currentSegmentSize;
+    size_t currentSegmentSize{0};      // only used by the appender (under ioMutex)
+
+    // Ring
+    std::unique_ptr<WalRingSlot[]> ring;
+    std::atomic<uint64_t> reservedLsn{0};  // last LSN given to a writer
+    std::atomic<uint64_t> dequeueLsn{1};   // next LSN the appender takes from the ring
+    std::atomic<uint64_t> durableLsn{0};
+    std::atomic<size_t> queuedBytes{0};
+    std::atomic<uint8_t> appenderState{APPENDER_RUNNING};
+    std::atomic<int> urgentFlushes{0};     // Flush() callers, appender skips group/interval delay
+    std::atomic<bool> ioFailed{false};
+    std::atomic<bool> stopping{false};
+
+    // Group commit
+    std::atomic<WalSyncPolicy> syncPolicy{WalSyncPolicy::GROUP};
+    std::chrono::microseconds groupCommitDelay{DEFAULT_GROUP_COMMIT_DELAY_US};
+    std::chrono::milliseconds syncInterval{DEFAULT_SYNC_INTERVAL_MS};
+    mutable std::mutex walMutex;           // condition variables, delays, resetGeneration
+    std::mutex ioMutex;
+    std::condition_variable recordsQueued;
+    std::condition_variable durableAdvanced;
+    uint64_t resetGeneration{0}; // incremented by ClearAll, waiters for older LSNs are released
+    int walFd{-1};               // only used under ioMutex
+    uint64_t walFdSegment{0};
+    string writeBuffer;
+    std::thread appenderThread;
+
+    // Segment index (segment number -> index). Newest segment is indexed when WAL is opened, older ones when first needed;
+    // the appender keeps the current segment's index up to date
+    mutable std::mutex indexMutex;
+    std::map<uint64_t, WalSegmentIndex> segmentIndexes;
 
+    std::mutex recycleMutex;     // recycled segment pool (<name>_<n>.free files)
+    std::mutex detachedMutex;    // serializes RecycleSegments (zeroing of detached <name>_<n>.recycle files)
+
+    // Compaction (CompactSegments). segmentMaintenanceMutex serializes compaction, segment deletion and ClearAll;
+    // segmentFilesMutex is exclusive while a compacted file replaces a segment, readers hold it shared while opening one.
+    std::mutex segmentMaintenanceMutex;
+    std::shared_mutex segmentFilesMutex;
+    uint64_t compactedBeforeSegment{0};
 
-    bool RotateWAL();
     fs::path GetSegmentPath(const uint64_t &segmentNum) const;
     vector<fs::path> GetAllSegments() const;
-    bool ShouldRotate() const;
 
-    bool OpenWAL();
-    uint64_t GetNextSequenceNumber();
-    static WalRecord ParseWalRecord(const string &line);
+    bool Append(WalRecord &record, bool assignLsn);
+    void AppenderLoop();
+    bool WaitForRecords();
+    void WriteQueuedIoLocked();
+    bool RecordReady(uint64_t lsn) const;
+    void ResetRingIoLocked(uint64_t lastLsn);
+    void Rebase(uint64_t lastLsn);
+    void Flush();
+    void NotifyAppender();
+    int OpenSegmentFile(uint64_t segmentNumber);
+    bool WriteEmptySegment(int fd, size_t fileSize) const;
+    bool PrepareSegmentFile(const fs::path &segmentPath);
+    bool TakeRecycledSegment(fs::path &recycledPath);
+    void RecycleSegment(const fs::path &segmentPath);
+    bool WriteEndMarkerIoLocked(size_t offset);
+    bool WriteBufferIoLocked(size_t offset);
+    void CloseSegmentFile();
+    void EnsureSequenceNumberAtLeast(uint64_t lsn);
+    bool FindReadOffset(const fs::path &segmentPath, uint64_t afterLsn, size_t &startOffset);
+    uint64_t SegmentFirstLsn(const fs::path &segmentPath);
+    vector<size_t> ChunkOffsets(const fs::path &segmentPath, size_t startOffset);
 
-    bool WriteRecordToStream(const WalRecord& record);
+    static WalRecord ParseWalRecord(const string &line);
+    static void EncodeRecord(const WalRecord &record, string &out);
+    static WalDecodeStatus DecodeRecord(const char *data, size_t size, size_t &offset, WalRecord &record);
+    static bool IsTextSegment(const fs::path &segmentPath);
+    static size_t ReadSegment(const fs::path &segmentPath, uint64_t afterLsn, vector<WalRecord> &records, size_t maxBytes = SIZE_MAX,
+                              size_t startOffset = 0, WalSegmentIndex *index = nullptr);
+    static uint64_t SegmentNumber(const fs::path &segmentPath);
+    static uint64_t ReadFirstLsn(const fs::path &segmentPath);
 
 public:
     static constexpr size_t DEFAULT_SEGMENT_SIZE = 16UL * 1024UL * 1024UL;
+    static constexpr int DEFAULT_GROUP_COMMIT_DELAY_US = 200;
+    static constexpr int DEFAULT_SYNC_INTERVAL_MS = 10;
+    static constexpr size_t GROUP_COMMIT_MAX_BYTES = 1024UL * 1024UL; // flush group early when it gets this big
+    static constexpr size_t MAX_RECYCLED_SEGMENTS = 4;                 // segments kept for reuse after truncation
 
     explicit WAL(const string &databaseName, size_t MaxSegmentSizeBytes = DEFAULT_SEGMENT_SIZE); // Default 16MB. Same as Postgres
+    ~WAL();
+    WAL(const WAL &) = delete;
+    WAL &operator=(const WAL &) = delete;
 
     bool LogSet(const string &key, const string &value);
     bool LogDelete(const string &key);
 
     bool LogWithLSN(WalRecord &walRecord);
 
+    void SetSyncPolicy(WalSyncPolicy policy, std::chrono::microseconds groupDelay, std::chrono::milliseconds interval);
+    bool WaitDurable(uint64_t lsn);
+    uint64_t GetDurableLsn() const;
+
+    WalReader OpenReader(uint64_t afterLsn, size_t parallelSegments = 1);
     vector<WalRecord> ReadAll();
     vector<WalRecord> ReadFrom(const uint64_t &lsn);
     bool HasPendingRecords();
 
-    uint64_t GetCurrentSequenceNumber() const { return currentSequenceNumber; }
-    uint64_t GetCurrentSegmentNumber() const { return currentSegmentNumber; }
+    uint64_t GetCurrentSequenceNumber() const;
+    uint64_t GetCurrentSegmentNumber() const;
+    uint64_t GetFirstLsn();
 
     bool ClearAll();
     bool ClearUpTo(const uint64_t &lsn);
+    size_t CompactSegments(size_t maxSegments);
     bool DeleteOldSegments(const uint64_t &beforeSegment);
-};
\ No newline at end of file
+    void RecycleSegments();
+};
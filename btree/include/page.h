@@ -4,6 +4,7 @@
 #include <cstring>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <iostream>
 #include <fstream>
 #include <utility>
@@ -22,11 +23,12 @@ using std::vector;
 struct PageHeader {
     bool isLeaf;
     uint32_t pageID;
-    uint32_t parentPageID;
     uint16_t numberOfCells;
     uint16_t offsetToStartOfFreeSpace;
     uint16_t offsetToEndOfFreeSpace;
     uint16_t offsetToStartOfSpecialSpace;
+    uint16_t deadBytes; // bytes of cells that are no longer referenced (removed or overwritten)
+    uint64_t pageLSN;   // LSN (+ MetaPageHeader::lsnBase) of the last logged change written to this page
     void CoutHeader();
 };
 
@@ -39,6 +41,8 @@ struct MetaPageHeader {
     uint32_t lastPageID;
     uint64_t keyNumber;
     uint64_t lastSequenceNumber;
+    uint64_t checkpointLSN; // all changes up to this LSN are in the pages, recovery starts after it
+    uint64_t lsnBase;       // added to WAL LSNs when stamping pages, grows when WAL numbering is reset
     void CoutHeader();
 };
 
@@ -122,6 +126,7 @@ class BasicPage : public Page{
 
         //helpers
         int16_t FreeSpace();
+        double DeadSpaceRatio();
 };
 
 /**
@@ -0,0 +1,51 @@
+#include "../include/crc32c.hpp"
+#include <array>
+
+namespace {
+constexpr uint32_t CRC32C_POLYNOMIAL = 0x82F63B78; // reversed 0x1EDC6F41
+
+// 8 tables for slicing-by-8: table[k][b] is crc of byte b followed by k zero bytes
+using Crc32cTables = std::array<std::array<uint32_t, 256>, 8>;
+
+constexpr Crc32cTables MakeTables() {
+    Crc32cTables tables{};
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1U) ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+        }
+        tables[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (size_t k = 1; k < 8; k++) {
+            tables[k][i] = (tables[k - 1][i] >> 8) ^ tables[0][tables[k - 1][i] & 0xFFU];
+        }
+    }
+    return tables;
+}
+
+constexpr Crc32cTables TABLES = MakeTables();
+}
+
+uint32_t Crc32c(const void *data, size_t length, uint32_t crc) {
+    const auto *bytes = static_cast<const unsigned char *>(data);
+    crc = ~crc;
+
+    // 8 bytes at a time
+    while (length >= 8) {
+        uint32_t low = crc ^ (static_cast<uint32_t>(bytes[0]) | static_cast<uint32_t>(bytes[1]) << 8 |
+                              static_cast<uint32_t>(bytes[2]) << 16 | static_cast<uint32_t>(bytes[3]) << 24);
+        crc = TABLES[7][low & 0xFFU] ^ TABLES[6][(low >> 8) & 0xFFU] ^
+              TABLES[5][(low >> 16) & 0xFFU] ^ TABLES[4][low >> 24] ^
+              TABLES[3][bytes[4]] ^ TABLES[2][bytes[5]] ^
+              TABLES[1][bytes[6]] ^ TABLES[0][bytes[7]];
+        bytes += 8;
+        length -= 8;
+    }
+
+    // remaining bytes
+    while (length-- > 0) {
+        crc = (crc >> 8) ^ TABLES[0][(crc ^ *bytes++) & 0xFFU];
+    }
+    return ~crc;
+}
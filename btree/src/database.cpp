@@ -4,10 +4,14 @@
 #include <cstdint>
 #include <cstring>
 #include <exception>
+#include <fcntl.h>
 #include <filesystem>
 #include <fstream>
+#include <mutex>
 #include <optional>
+#include <shared_mutex>
 #include <stdexcept>
+#include <unistd.h>
 #include <vector>
 #include "../include/page.h"
 #include "../include/internalpage.h"
@@ -19,6 +23,35 @@ using std::ifstream;
 using std::memcpy;
 using std::cout;
 
+namespace {
+    // pread/pwrite visam buferiui (trumpi skaitymai/rašymai kartojami)
+    bool ReadAt(int fd, char *data, size_t size, uint64_t offset) {
+        while (size > 0) {
+            ssize_t result = ::pread(fd, data, size, static_cast<off_t>(offset));
+            if (result <= 0) {
+                return false;
+            }
+            data += result;
+            size -= static_cast<size_t>(result);
+            offset += static_cast<uint64_t>(result);
+        }
+        return true;
+    }
+
+    bool WriteAt(int fd, const char *data, size_t size, uint64_t offset) {
+        while (size > 0) {
+            ssize_t result = ::pwrite(fd, data, size, static_cast<off_t>(offset));
+            if (result <= 0) {
+                return false;
+            }
+            data += result;
+            size -= static_cast<size_t>(result);
+            offset += static_cast<uint64_t>(result);
+        }
+        return true;
+    }
+}
+
 // ---------------- Database ----------------
 Database::Database(const string &name) : name(name), wal(name) {
     fs::path fileName(name + ".db");
@@ -52,6 +85,33 @@ Database::Database(const string &name) : name(name), wal(name) {
 
         cout << "Database created successfully: " << this->pathToDatabaseFile << "\n";
     }
+
+    // redo changes that were logged after the last checkpoint but may be missing from the pages
+    this->RecoverFromWal();
+
+    // if WAL tail was lost, new LSNs must still be bigger than the ones stamped on pages
+    this->wal.EnsureSequenceNumberAtLeast(this->ReadMetaPage().Header()->lastSequenceNumber);
+}
+
+/**
+ * @brief Reads last applied LSN straight from the meta page of data/<name>.db,
+ * without opening the WAL or running recovery. For processes that only watch another node's database.
+ *
+ * @param name database name
+ * @return lastSequenceNumber or 0 if database does not exist
+ */
+uint64_t Database::ReadStoredLSN(const string &name) {
+    fs::path path = fs::path("data") / (name + ".db");
+    ifstream databaseFile(path.string(), ios::in | ios::binary);
+    if (!databaseFile) {
+        return 0;
+    }
+    MetaPage Meta;
+    databaseFile.read(Meta.mData, Page::PAGE_SIZE);
+    if (!databaseFile) {
+        return 0;
+    }
+    return Meta.Header()->lastSequenceNumber;
 }
 
 string Database::getName() const {
@@ -140,6 +200,11 @@ bool Database::WriteBasicPage(BasicPage &pageToWrite) const {
     }
     // Go to page location
     uint32_t pageID = pageToWrite.Header()->pageID;
+
+    // snapshots still need the old version of the page
+    for (PageSnapshot *snapshot : this->activeSnapshots) {
+        snapshot->PreserveOldPage(pageID);
+    }
     databaseFile.seekp(pageID * Page::PAGE_SIZE, ios::beg);
     if (!databaseFile.good()) {
         throw std::runtime_error("seekp failed in WriteBasicPage");
@@ -182,6 +247,7 @@ bool Database::UpdateMetaPage(MetaPage &PageToWrite) const {
  * @return leafNodeCell struct (key:value pair) or nullopt (null)
  */
 std::optional<leafNodeCell> Database::Get(const string& key) const {
+    std::shared_lock<std::shared_mutex> lock(this->treeMutex);
     // check keys length
     if (key.length() > MAX_KEY_LENGTH) {
         throw std::length_error("Key is too long! (max size: 255)");
@@ -238,6 +304,20 @@ std::optional<leafNodeCell> Database::Get(const string& key) const {
  * @return true on success
  */
 bool Database::Set(const string& key, const string& value){
+    std::unique_lock<std::shared_mutex> lock(this->treeMutex);
+    return this->ApplySet(key, value, 0);
+}
+
+/**
+ * @brief Set without locking. Written pages are stamped with lsn (if it is not 0),
+ * and meta page lastSequenceNumber is moved to it in the same meta write.
+ *
+ * @param key
+ * @param value
+ * @param lsn WAL LSN of this change, 0 if change is not logged
+ * @return true on success
+ */
+bool Database::ApplySet(const string& key, const string& value, uint64_t lsn){
     // check strings length
     if (key.length() > MAX_KEY_LENGTH) {
         throw std::length_error("Key is too long! (max size: 255)");
@@ -260,34 +340,74 @@ bool Database::Set(const string& key, const string& value){
         throw std::runtime_error("rootPageID is zero!");
     }
 
-    //read root page
+    // appends past the rightmost leaf fence go straight to the cached leaf
+    vector<uint32_t> path;
     BasicPage currentPage;
-    try{
-        currentPage = this->ReadPage(rootPageID);
-    }
-    catch (std::exception& e) {
-        std::cerr << e.what();
-        throw;
+    bool useCachedLeaf = this->rightmostLeaf.valid && (!this->rightmostLeaf.hasFenceKey || key > this->rightmostLeaf.fenceKey);
+    if (useCachedLeaf) {
+        path = this->rightmostLeaf.path;
+        try{
+            currentPage = this->ReadPage(this->rightmostLeaf.leafID);
+        }
+        catch (std::exception& e) {
+            std::cerr << e.what();
+            throw;
+        }
     }
-
-    //loop to leaf page
-    while (!currentPage.Header()->isLeaf){
-        InternalPage internal(currentPage);
-        uint32_t pageID = internal.FindPointerByKey(key);
+    else {
+        //read root page
         try{
-            currentPage = this->ReadPage(pageID);
+            currentPage = this->ReadPage(rootPageID);
         }
         catch (std::exception& e) {
             std::cerr << e.what();
             throw;
         }
+
+        //loop to leaf page, remembering the path (internal page ids from root) for splits
+        bool rightmostDescent = true;
+        bool hasFenceKey = false;
+        string fenceKey;
+        while (!currentPage.Header()->isLeaf){
+            path.push_back(currentPage.Header()->pageID);
+            InternalPage internal(currentPage);
+            uint32_t pageID = internal.FindPointerByKey(key);
+            if (pageID != *internal.Special1()) {
+                rightmostDescent = false;
+            }
+            else if (internal.Header()->numberOfCells > 0) {
+                hasFenceKey = true;
+                fenceKey = internal.GetKeyAndPointer(internal.Offsets()[internal.Header()->numberOfCells - 1]).key;
+            }
+            try{
+                currentPage = this->ReadPage(pageID);
+            }
+            catch (std::exception& e) {
+                std::cerr << e.what();
+                throw;
+            }
+        }
+        if (rightmostDescent) {
+            this->rightmostLeaf = {true, currentPage.Header()->pageID, hasFenceKey, fenceKey, path};
+        }
     }
     // Should it increase key counter in metapage?
     bool increaseKeyCount = false;
-    // Try to insert
+    bool metaChanged = false;
+    uint64_t pageLSN = (lsn != 0) ? Meta.Header()->lsnBase + lsn : 0;
+    // Try to insert (or overwrite in place)
     LeafPage leaf(currentPage);
-    if (leaf.WillFit(key, value)) {
-        increaseKeyCount = leaf.InsertKeyValue(key, value); //true if new key was added
+    InsertResult result = leaf.InsertKeyValue(key, value);
+    // If doesnt fit - optimize, but only if reclaimed dead space would make room
+    if (result == InsertResult::NO_SPACE && leaf.WillFitAfterOptimize(key, value)) {
+        leaf = leaf.Optimize();
+        result = leaf.InsertKeyValue(key, value);
+    }
+    if (result != InsertResult::NO_SPACE) {
+        increaseKeyCount = (result == InsertResult::INSERTED); //true if new key was added
+        if (pageLSN != 0) {
+            leaf.Header()->pageLSN = pageLSN;
+        }
         try{
             this->WriteBasicPage(leaf);
         }
@@ -296,30 +416,30 @@ bool Database::Set(const string& key, const string& value){
             throw;
         }
     }
-    // If doesnt fit - optimize and then try
+    // If still doesnt fit - split (the key is inserted into one of the halves)
     else {
-        leaf = leaf.Optimize();
-        if (leaf.WillFit(key, value)) {
-            increaseKeyCount = leaf.InsertKeyValue(key, value);
-            try{
-            this->WriteBasicPage(leaf);
-            }
-            catch (std::exception& e) {
-                std::cerr << e.what();
-                throw;
-            }
+        try {
+            increaseKeyCount = this->SplitLeafPage(leaf, key, value, path, Meta, pageLSN);
         }
-        // If still doesnt fit - split
-        else {
-            this->SplitLeafPage(leaf);
-            this->Set(key, value);
-            return true;
+        catch (std::exception& e) {
+            std::cerr << e.what();
+            throw;
         }
+        metaChanged = true;
+        // rightmost leaf or its path may have changed
+        this->rightmostLeaf.valid = false;
     }
-    // update keyCounter
+    // update keyCounter (and lastPageID/rootPageID if split happened)
     if (increaseKeyCount) {
+        Meta.Header()->keyNumber++;
+        metaChanged = true;
+    }
+    if (lsn > Meta.Header()->lastSequenceNumber) {
+        Meta.Header()->lastSequenceNumber = lsn;
+        metaChanged = true;
+    }
+    if (metaChanged) {
         try {
-            Meta.Header()->keyNumber++;
             this->UpdateMetaPage(Meta);
         }
         catch (std::exception& e) {
@@ -332,41 +452,75 @@ bool Database::Set(const string& key, const string& value){
 }
 
 /**
- * @brief Splits leaf page into 2 pages (b+tree node)
+ * @brief Splits leaf page into 2 pages (b+tree node) and inserts key:value pair into the half it belongs to.
+ * Usually splits bytes 50/50, but when the key goes past the last key of the leaf (sequential / time ordered keys)
+ * APPEND_SPLIT_RATIO of the bytes stay on the left, so left leaves are left almost full instead of half empty.
+ * The split point is clamped so both halves (the new pair included) fit into a page.
+ * Split is propagated upwards using the path recorded during descent.
+ * Meta page is only changed in memory, caller has to write it.
  *
- * @param LeafToSplit
+ * @param LeafToSplit full leaf
+ * @param key key to insert
+ * @param value value to insert
+ * @param path internal page ids from root to the parent of LeafToSplit
+ * @param Meta meta page (lastPageID and rootPageID get updated)
+ * @param pageLSN LSN to stamp written pages with (0 - keep the old one)
+ * @return true if new key was added
  */
-void Database::SplitLeafPage(LeafPage& LeafToSplit) {
+bool Database::SplitLeafPage(LeafPage& LeafToSplit, const string &key, const string &value, vector<uint32_t> &path, MetaPage &Meta, uint64_t pageLSN) {
 #ifdef DEBUG
     std::cout << "Splitting leaf page: " << LeafToSplit.Header()->pageID << std::endl;
 #endif
-    // re-read page before working to get the newest data
-    try {
-        LeafToSplit = this->ReadPage(LeafToSplit.Header()->pageID);
+    // all cells in key order together with the new pair (an update replaces the old value)
+    uint16_t numberOfCells = LeafToSplit.Header()->numberOfCells;
+    vector<leafNodeCell> cells;
+    cells.reserve(numberOfCells + 1);
+    for (uint16_t i = 0; i < numberOfCells; i++) {
+        cells.push_back(LeafToSplit.GetKeyValue(LeafToSplit.Offsets()[i]));
+    }
+    uint16_t position = LeafToSplit.FindInsertPosition(key);
+    bool newKey = !(position < numberOfCells && cells[position].key == key);
+    if (newKey) {
+        cells.insert(cells.begin() + position, leafNodeCell(key, value));
     }
-    catch (std::exception& e) {
-        std::cerr << e.what() << "\n";
-        throw;
+    else {
+        cells[position].value = value;
     }
-    uint16_t rightPart = LeafToSplit.Header()->numberOfCells / 2;
-    uint16_t leftPart = LeafToSplit.Header()->numberOfCells - rightPart;
-    string keyToMoveToParent = LeafToSplit.GetKeyValue(LeafToSplit.Offsets()[leftPart-1]).key;
-
-    // check if the parent needs to be splitted
-    uint32_t parentID = LeafToSplit.Header()->parentPageID;
-    if (parentID != 0) {
-        InternalPage parent = this->ReadPage(parentID);
-        bool fit = parent.WillFit(keyToMoveToParent, LeafToSplit.Header()->pageID);
-        if (!fit) {
-            this->SplitInternalPage(parent);
-            this->SplitLeafPage(LeafToSplit);
-            return;
-        }
+
+    // split point is chosen by bytes (cell + its offset), cells can differ in size up to ~2.3KB
+    size_t totalBytes = 0;
+    vector<size_t> cellBytes;
+    cellBytes.reserve(cells.size());
+    for (const auto &cell : cells) {
+        cellBytes.push_back(cell.key.size() + cell.value.size() + 2 * sizeof(uint16_t) + sizeof(uint16_t));
+        totalBytes += cellBytes.back();
+    }
+    bool append = newKey && position == numberOfCells;
+    auto targetBytes = static_cast<size_t>(totalBytes * (append ? APPEND_SPLIT_RATIO : 0.5));
+    size_t leftPart = 0;
+    size_t leftBytes = 0;
+    while (leftPart < cells.size() && leftBytes + cellBytes[leftPart] <= targetBytes) {
+        leftBytes += cellBytes[leftPart++];
+    }
+    // both halves have to fit into a page, appended key always starts the new right leaf
+    auto capacity = static_cast<size_t>(LeafPage(0).FreeSpace());
+    leftPart = std::clamp<size_t>(leftPart, 1, cells.size() - 1);
+    leftBytes = 0;
+    for (size_t i = 0; i < leftPart; i++) {
+        leftBytes += cellBytes[i];
+    }
+    while (totalBytes - leftBytes > capacity && leftPart < cells.size() - 1) {
+        leftBytes += cellBytes[leftPart++];
     }
+    while (leftBytes > capacity && leftPart > 1) {
+        leftBytes -= cellBytes[--leftPart];
+    }
+    if (leftBytes > capacity || totalBytes - leftBytes > capacity) {
+        throw std::runtime_error("Leaf split: cells do not fit into two pages");
+    }
+    string keyToMoveToParent = cells[leftPart - 1].key;
 
     // get new children IDs
-    MetaPage Meta;
-    Meta = this->ReadPage(0);
     uint32_t Child1ID = LeafToSplit.Header()->pageID; // Old page ID
     uint32_t Child2ID = Meta.Header()->lastPageID + 1; // Creating new page
     Meta.Header()->lastPageID++;
@@ -379,172 +533,142 @@ void Database::SplitLeafPage(LeafPage& LeafToSplit) {
     memcpy(Child2.Special1(), &Child1ID, sizeof(uint32_t));
     memcpy(Child2.Special2(), LeafToSplit.Special2(), sizeof(uint32_t));
 
-    //split leaf into 2 leaves
-    uint16_t i = 0;
-    for (i = 0; i < leftPart; i++) {
-        auto cell = LeafToSplit.GetKeyValue(LeafToSplit.Offsets()[i]);
-        Child1.InsertKeyValue(cell.key, cell.value);
-    }
-    for (; i < LeafToSplit.Header()->numberOfCells; i++) {
-        auto cell = LeafToSplit.GetKeyValue(LeafToSplit.Offsets()[i]);
-        Child2.InsertKeyValue(cell.key, cell.value);
+    //split cells (new pair included) into 2 leaves
+    for (size_t i = 0; i < cells.size(); i++) {
+        LeafPage &child = (i < leftPart) ? Child1 : Child2;
+        if (child.InsertKeyValue(cells[i].key, cells[i].value) == InsertResult::NO_SPACE) {
+            throw std::runtime_error("Leaf split: cell does not fit into its half");
+        }
     }
 
-    //add key to parent or create parent
-    if (parentID == 0) {
-        // get new parent id
-        uint32_t newParentID = Meta.Header()->lastPageID + 1;
-        Meta.Header()->lastPageID++;
+    // both halves carry the change (and everything the old leaf had)
+    uint64_t newPageLSN = std::max(pageLSN, LeafToSplit.Header()->pageLSN);
+    Child1.Header()->pageLSN = newPageLSN;
+    Child2.Header()->pageLSN = newPageLSN;
 
-        //create parent and insert pointers
-        InternalPage Parent(newParentID);
-        Parent.InsertKeyAndPointer(keyToMoveToParent, Child1ID);
-        memcpy(Parent.Special1(), &Child2ID, sizeof(Child2ID));
+    // next leaf has to point back to the new page
+    if (*Child2.Special2() != 0) {
+        LeafPage NextLeaf = this->ReadPage(*Child2.Special2());
+        memcpy(NextLeaf.Special1(), &Child2ID, sizeof(uint32_t));
+        this->WriteBasicPage(NextLeaf);
+    }
 
-        // make parent the root
-        Meta.Header()->rootPageID = newParentID;
+    //write pages and add key to parent (or create parent)
+    this->WriteBasicPage(Child1);
+    this->WriteBasicPage(Child2);
+    this->InsertIntoParent(path, keyToMoveToParent, Child1ID, Child2ID, Meta, pageLSN);
+    return newKey;
+}
 
-        // change parent pointers
-        Child1.Header()->parentPageID = newParentID;
-        Child2.Header()->parentPageID = newParentID;
+/**
+ * @brief Inserts separator key after a split into the parent taken from the path.
+ * If parent is full it is split too and it goes one level up, until it fits or new root is created.
+ *
+ * @param path internal page ids from root (last one is the parent of split page)
+ * @param key separator key (left child has keys <= key)
+ * @param leftChildID page that was split
+ * @param rightChildID new page
+ * @param Meta meta page (lastPageID and rootPageID get updated)
+ * @param pageLSN LSN to stamp written pages with (0 - keep the old one)
+ */
+void Database::InsertIntoParent(vector<uint32_t> &path, string key, uint32_t leftChildID, uint32_t rightChildID, MetaPage &Meta, uint64_t pageLSN) {
+    while (!path.empty()) {
+        InternalPage Parent = this->ReadPage(path.back());
+        path.pop_back();
+
+        if (Parent.WillFit(key, leftChildID)) {
+            Parent.InsertKeyAndPointer(key, leftChildID);
+            Parent.UpdatePointerToTheRightFromKey(key, rightChildID);
+            if (pageLSN != 0) {
+                Parent.Header()->pageLSN = pageLSN;
+            }
+            this->WriteBasicPage(Parent);
+            return;
+        }
 
-        // write pages
-        this->WriteBasicPage(Parent);
-        this->WriteBasicPage(Child1);
-        this->WriteBasicPage(Child2);
-        this->UpdateMetaPage(Meta);
+        // parent is full - split it. key and children are replaced with the ones for the next level
+        this->SplitInternalPage(Parent, key, leftChildID, rightChildID, Meta, pageLSN);
     }
-    else {
-        // get parent
-        InternalPage Parent = this->ReadPage(parentID);
 
-        //update parent pointers
-        Child1.Header()->parentPageID = parentID;
-        Child2.Header()->parentPageID = parentID;
+    // root was split - create new root
+    uint32_t newRootID = Meta.Header()->lastPageID + 1;
+    Meta.Header()->lastPageID++;
 
-        //insert key and pointers
-        Parent.InsertKeyAndPointer(keyToMoveToParent, Child1ID);
-        Parent.UpdatePointerToTheRightFromKey(keyToMoveToParent, Child2ID);
+    InternalPage Root(newRootID);
+    Root.InsertKeyAndPointer(key, leftChildID);
+    memcpy(Root.Special1(), &rightChildID, sizeof(rightChildID));
+    Root.Header()->pageLSN = pageLSN;
+    Meta.Header()->rootPageID = newRootID;
 
-        //write pages
-        this->WriteBasicPage(Parent);
-        this->WriteBasicPage(Child1);
-        this->WriteBasicPage(Child2);
-        this->UpdateMetaPage(Meta);
-    }
+    this->WriteBasicPage(Root);
 }
+
 /**
- * @brief Splits internal page (b+tree node)
+ * @brief Splits internal page (b+tree node) while inserting pending key and pointers into it
  *
- * @param InternalToSplit
+ * @param InternalToSplit full internal page
+ * @param key in: key to insert, out: key to move to parent
+ * @param leftChildID in: pointer to insert with key, out: id of the left half
+ * @param rightChildID in: pointer to the right of key, out: id of the right half
+ * @param Meta meta page (lastPageID gets updated)
+ * @param pageLSN LSN to stamp written pages with (0 - keep the old one)
  */
-void Database::SplitInternalPage(InternalPage& InternalToSplit){
+void Database::SplitInternalPage(InternalPage& InternalToSplit, string &key, uint32_t &leftChildID, uint32_t &rightChildID, MetaPage &Meta, uint64_t pageLSN){
 #ifdef DEBUG
     std::cout << "Splitting internal page: " << InternalToSplit.Header()->pageID << std::endl;
 #endif
-    // Reread the page to get latest info
-    InternalToSplit = this->ReadPage(InternalToSplit.Header()->pageID);
+    // collect all cells together with the pending one
+    uint16_t numberOfCells = InternalToSplit.Header()->numberOfCells;
+    vector<internalNodeCell> cells;
+    cells.reserve(numberOfCells + 1);
+    for (uint16_t i = 0; i < numberOfCells; i++) {
+        cells.push_back(InternalToSplit.GetKeyAndPointer(InternalToSplit.Offsets()[i]));
+    }
+    uint32_t lastPointer = *InternalToSplit.Special1();
+
+    // pointer to the right of the new key now points to the right child
+    uint16_t position = InternalToSplit.FindInsertPosition(key);
+    if (position < numberOfCells) {
+        cells[position].childPointer = rightChildID;
+    }
+    else {
+        lastPointer = rightChildID;
+    }
+    cells.insert(cells.begin() + position, internalNodeCell(key, leftChildID));
 
     // check which key to move to parent
-    uint16_t total = InternalToSplit.Header()->numberOfCells;
+    uint16_t total = cells.size();
     uint16_t mid = total / 2;
-    string keyToMoveToParent = InternalToSplit.GetKeyAndPointer(InternalToSplit.Offsets()[mid]).key;
-
-    // check if the parent needs to be splitted
-    uint32_t parentID = InternalToSplit.Header()->parentPageID;
-    if (parentID != 0) {
-        InternalPage parent = this->ReadPage(parentID);
-        bool fit = parent.WillFit(keyToMoveToParent, InternalToSplit.Header()->pageID);
-        if (!fit) {
-            this->SplitInternalPage(parent);
-            this->SplitInternalPage(InternalToSplit);
-            return;
-        }
-    }
 
-    // read meta page (for last page ID)
-    MetaPage Meta;
-    Meta = this->ReadPage(0);
+    // create 2 new childs
     uint32_t Child1ID = InternalToSplit.Header()->pageID;
     uint32_t Child2ID = Meta.Header()->lastPageID + 1;
-
-    // create 2 new childs
+    Meta.Header()->lastPageID++;
     InternalPage Child1(Child1ID);
     InternalPage Child2(Child2ID);
-    Meta.Header()->lastPageID++;
 
     //split internal into 2 internals
-    // fill first child
+    // fill first child, pointer of middle key (that will be moved to parent) goes to child1 special
     for (uint16_t i = 0; i < mid; i++) {
-        auto cell = InternalToSplit.GetKeyAndPointer(InternalToSplit.Offsets()[i]);
-        Child1.InsertKeyAndPointer(cell.key, cell.childPointer);
+        Child1.InsertKeyAndPointer(cells[i].key, cells[i].childPointer);
     }
-    //copy pointer of middle key (that will be moved to parent) to child1 special
-    uint32_t pointerOfKeyToMoveToParent = InternalToSplit.GetKeyAndPointer(InternalToSplit.Offsets()[mid]).childPointer;
-    memcpy(Child1.Special1(), &pointerOfKeyToMoveToParent, sizeof(pointerOfKeyToMoveToParent));
+    memcpy(Child1.Special1(), &cells[mid].childPointer, sizeof(uint32_t));
 
     //fill second child and assing special pointer (to the most right child)
     for (uint16_t i = mid + 1; i < total; i++) {
-        auto cell = InternalToSplit.GetKeyAndPointer(InternalToSplit.Offsets()[i]);
-        Child2.InsertKeyAndPointer(cell.key, cell.childPointer);
-    }
-    memcpy(Child2.Special1(), InternalToSplit.Special1(), sizeof(pointerOfKeyToMoveToParent));
-
-    //update child2 children parentpointers (child1 id is the same so it not needed to be updated)
-    for (uint16_t j = 0; j < Child2.Header()->numberOfCells; j++) {
-        auto cell = Child2.GetKeyAndPointer(Child2.Offsets()[j]);
-        BasicPage GrandchildPage = this->ReadPage(cell.childPointer);
-        GrandchildPage.Header()->parentPageID = Child2ID;
-        this->WriteBasicPage(GrandchildPage);
+        Child2.InsertKeyAndPointer(cells[i].key, cells[i].childPointer);
     }
-    // update latest grandchild parentpointer
-    {
-        BasicPage GrandchildPage = this->ReadPage(*Child2.Special1());
-        GrandchildPage.Header()->parentPageID = Child2ID;
-        this->WriteBasicPage(GrandchildPage);
-    }
-    //add key to parent or create parent
-    if (parentID == 0) {
-        // get new parent id
-        uint32_t newParentID = Meta.Header()->lastPageID + 1;
-        Meta.Header()->lastPageID++;
-
-        //create parent and insert pointers
-        InternalPage Parent(newParentID);
-        Parent.InsertKeyAndPointer(keyToMoveToParent, Child1ID);
-        memcpy(Parent.Special1(), &Child2ID, sizeof(Child2ID));
-
-        // make parent the root
-        Meta.Header()->rootPageID = newParentID;
-
-        // change parent pointers
-        Child1.Header()->parentPageID = newParentID;
-        Child2.Header()->parentPageID = newParentID;
-
-        // write pages
-        this->WriteBasicPage(Parent);
-        this->WriteBasicPage(Child1);
-        this->WriteBasicPage(Child2);
-        this->UpdateMetaPage(Meta);
-    }
-    else {
-        // get parent
-        InternalPage Parent = this->ReadPage(parentID);
-
-        //update parent pointers
-        Child1.Header()->parentPageID = parentID;
-        Child2.Header()->parentPageID = parentID;
+    memcpy(Child2.Special1(), &lastPointer, sizeof(lastPointer));
+    Child1.Header()->pageLSN = std::max(pageLSN, InternalToSplit.Header()->pageLSN);
+    Child2.Header()->pageLSN = Child1.Header()->pageLSN;
 
-        //insert key and pointers
-        Parent.InsertKeyAndPointer(keyToMoveToParent, Child1ID); //ADD CHECK FOR FREE SPACE!
-        Parent.UpdatePointerToTheRightFromKey(keyToMoveToParent, Child2ID);
+    // write pages
+    this->WriteBasicPage(Child1);
+    this->WriteBasicPage(Child2);
 
-        //write pages
-        this->WriteBasicPage(Parent);
-        this->WriteBasicPage(Child1);
-        this->WriteBasicPage(Child2);
-        this->UpdateMetaPage(Meta);
-    }
+    key = cells[mid].key;
+    leftChildID = Child1ID;
+    rightChildID = Child2ID;
 }
 /**
  * @brief Gets all keys from Database
@@ -552,6 +676,7 @@ void Database::SplitInternalPage(InternalPage& InternalToSplit){
  * @return
  */
 vector<string> Database::GetKeys() const {
+    std::shared_lock<std::shared_mutex> lock(this->treeMutex);
     // Read meta page for root page id
     MetaPage Meta;
     try {
@@ -624,6 +749,7 @@ vector<string> Database::GetKeys() const {
  * @return pagingResult struct (see page.h)
  */
 pagingResultKeysOnly Database::GetKeysPaging(uint32_t pageSize, uint32_t pageNum) const{
+    std::shared_lock<std::shared_mutex> lock(this->treeMutex);
     // get root page id
     MetaPage Meta;
     try{
@@ -705,6 +831,7 @@ pagingResultKeysOnly Database::GetKeysPaging(uint32_t pageSize, uint32_t pageNum
  * @return
  */
 vector<leafNodeCell> Database::GetKeysValues() const{
+    std::shared_lock<std::shared_mutex> lock(this->treeMutex);
 
     // Read meta page for root page id
     MetaPage Meta;
@@ -779,6 +906,7 @@ vector<leafNodeCell> Database::GetKeysValues() const{
  * @return pagingResult struct (see page.h)
  */
 pagingResult Database::GetKeysValuesPaging(uint32_t pageSize, uint32_t pageNum) const{
+    std::shared_lock<std::shared_mutex> lock(this->treeMutex);
     // get root page id
     MetaPage Meta;
     try{
@@ -862,6 +990,7 @@ pagingResult Database::GetKeysValuesPaging(uint32_t pageSize, uint32_t pageNum)
  * @return
  */
 vector<string> Database::GetKeys(const string &prefix) const {
+    std::shared_lock<std::shared_mutex> lock(this->treeMutex);
     MetaPage Meta;
     try {
         Meta = this->ReadPage(0);
@@ -951,6 +1080,7 @@ vector<string> Database::GetKeys(const string &prefix) const {
  * @return
  */
 vector<leafNodeCell> Database::GetFF(const string &key, uint32_t n) const {
+    std::shared_lock<std::shared_mutex> lock(this->treeMutex);
 
     vector<leafNodeCell> keyValuePairs;
     uint32_t counter = 0;
@@ -1041,6 +1171,7 @@ vector<leafNodeCell> Database::GetFF(const string &key, uint32_t n) const {
  * @return
  */
 vector<leafNodeCell> Database::GetFB(const string &key, uint32_t n) const {
+    std::shared_lock<std::shared_mutex> lock(this->treeMutex);
 
     vector<leafNodeCell> keyValuePairs;
     uint32_t counter = 0;
@@ -1202,6 +1333,19 @@ vector<leafNodeCell> Database::GetFB(const string &key, uint32_t n) const {
  * @return true on success
  */
 bool Database::Remove(const string& key) {
+    std::unique_lock<std::shared_mutex> lock(this->treeMutex);
+    return this->ApplyRemove(key, 0);
+}
+
+/**
+ * @brief Remove without locking. Leaf is stamped with lsn (if it is not 0),
+ * meta page lastSequenceNumber is moved to lsn even if key did not exist.
+ *
+ * @param key
+ * @param lsn WAL LSN of this change, 0 if change is not logged
+ * @return true if key was removed
+ */
+bool Database::ApplyRemove(const string& key, uint64_t lsn) {
     // validation
     if (key.length() > MAX_KEY_LENGTH) {
         throw std::length_error("Key is too long! (max length = 255)");
@@ -1245,24 +1389,27 @@ bool Database::Remove(const string& key) {
         }
     }
 
-    //get key from leaf page (if exists)
+    // remove key from leaf page (if exists) and write pages
     LeafPage leaf(currentPage);
-    auto cell = leaf.FindKey(key);
-    if (!cell.has_value()) {
-        return false;
-    }
-
-    // remove key if it exists and write pages
-    leaf.RemoveKey(key);
-    try {
-        this->WriteBasicPage(leaf);
+    bool removed = leaf.RemoveKey(key);
+    if (removed) {
+        if (lsn != 0) {
+            leaf.Header()->pageLSN = Meta.Header()->lsnBase + lsn;
+        }
+        try {
+            this->WriteBasicPage(leaf);
+        }
+        catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+            throw;
+        }
+        Meta.Header()->keyNumber--;
     }
-    catch (const std::exception& e) {
-        std::cerr << e.what() << "\n";
-        throw;
+    if (!removed && lsn <= Meta.Header()->lastSequenceNumber) {
+        return false;
     }
 
-    Meta.Header()->keyNumber--;
+    Meta.Header()->lastSequenceNumber = std::max(lsn, Meta.Header()->lastSequenceNumber);
     try {
         this->UpdateMetaPage(Meta);
     }
@@ -1271,16 +1418,63 @@ bool Database::Remove(const string& key) {
         throw;
     }
 
-    cout << "Removed key: " << key << "\n";
-    return true;
+    if (removed) {
+        cout << "Removed key: " << key << "\n";
+    }
+    return removed;
 }
 
 
+/**
+ * @brief Defragments leaves whose dead space ratio is at least deadRatio. Visits at most pageBudget leaves,
+ * continuing from where the previous call stopped, so it can be run in small steps from a background thread.
+ * Tree lock is taken for each leaf separately, so foreground operations wait for at most one page rebuild.
+ *
+ * @param deadRatio dead bytes / usable page bytes threshold
+ * @param pageBudget max number of leaves read in this call
+ * @return visited/defragmented leaf count and whether the scan reached the last leaf
+ */
+defragResult Database::DefragmentLeaves(double deadRatio, uint32_t pageBudget) {
+    defragResult result{0, 0, false};
+    while (result.pagesVisited < pageBudget) {
+        std::unique_lock<std::shared_mutex> lock(this->treeMutex);
+
+        // start from the first leaf
+        if (this->defragCursor == 0) {
+            MetaPage Meta = this->ReadPage(0);
+            BasicPage currentPage = this->ReadPage(Meta.Header()->rootPageID);
+            while (!currentPage.Header()->isLeaf){
+                InternalPage internal(currentPage);
+                uint32_t pageID = internal.GetKeyAndPointer(internal.Offsets()[0]).childPointer;
+                currentPage = this->ReadPage(pageID);
+            }
+            this->defragCursor = currentPage.Header()->pageID;
+        }
+
+        // leaves keep their ids after splits, so the cursor stays valid between calls
+        LeafPage leaf = this->ReadPage(this->defragCursor);
+        result.pagesVisited++;
+        if (leaf.Header()->deadBytes > 0 && leaf.DeadSpaceRatio() >= deadRatio) {
+            leaf = leaf.Optimize();
+            this->WriteBasicPage(leaf);
+            result.pagesDefragmented++;
+        }
+
+        this->defragCursor = *leaf.Special2();
+        if (this->defragCursor == 0) {
+            result.passFinished = true;
+            break;
+        }
+    }
+    return result;
+}
+
 /**
  * @brief Optimize database. Needed after many removals
  *
  */
 void Database::Optimize(){
+    std::unique_lock<std::shared_mutex> lock(this->treeMutex);
 
     // get old file size
     uintmax_t oldSize = 0;
@@ -1290,8 +1484,8 @@ void Database::Optimize(){
         std::cerr << "Error: " << e.what() << '\n';
     }
 
-    // create new b+tree
-    Database OptimizedDb(this->name + "optimized");
+    // create new b+tree (its WAL runs an appender thread, so it is destroyed before its files are moved or removed)
+    auto OptimizedDb = std::make_unique<Database>(this->name + "optimized");
 
     // read meta page
     MetaPage Meta;
@@ -1316,7 +1510,7 @@ void Database::Optimize(){
     LeafPage leaf(currentPage);
     for (uint32_t i = 0; i < leaf.Header()->numberOfCells; i++) {
         auto cell = leaf.GetKeyValue(leaf.Offsets()[i]);
-        OptimizedDb.Set(cell.key, cell.value);
+        OptimizedDb->Set(cell.key, cell.value);
     }
 
     // loop other leaves
@@ -1324,22 +1518,31 @@ void Database::Optimize(){
         leaf = ReadPage(*leaf.Special2());
         for (int i = 0; i < leaf.Header()->numberOfCells; i++) {
             auto cell = leaf.GetKeyValue(leaf.Offsets()[i]);
-            OptimizedDb.Set(cell.key, cell.value);
+            OptimizedDb->Set(cell.key, cell.value);
         }
     }
     // check newsize
     uintmax_t newSize = 0;
     try {
-        newSize = std::filesystem::file_size(OptimizedDb.pathToDatabaseFile);
+        newSize = std::filesystem::file_size(OptimizedDb->pathToDatabaseFile);
     } catch (const std::filesystem::filesystem_error& e) {
         std::cerr << "Error: " << e.what() << '\n';
     }
 
     // Read the old LSN from metapagehaeder.
-    uint64_t oldLSN = this->getLSN();
+    uint64_t oldLSN = Meta.Header()->lastSequenceNumber;
 
     // Write the old LSN to the new Optimized Database metapgehaeder.
-    OptimizedDb.writeLSN(oldLSN);
+    // New file already has every change up to it, so it is also the checkpoint.
+    MetaPage OptimizedMeta = OptimizedDb->ReadMetaPage();
+    OptimizedMeta.Header()->lastSequenceNumber = oldLSN;
+    OptimizedMeta.Header()->checkpointLSN = oldLSN;
+    OptimizedMeta.Header()->lsnBase = Meta.Header()->lsnBase;
+    OptimizedDb->UpdateMetaPage(OptimizedMeta);
+
+    fs::path optimizedPath = OptimizedDb->pathToDatabaseFile;
+    fs::path optimizedWalDirectory = OptimizedDb->wal.walDirectory;
+    OptimizedDb.reset();
 
     // rename new database file and delete the old one
     try {
@@ -1349,14 +1552,18 @@ void Database::Optimize(){
     }
 
     try {
-        std::filesystem::rename(OptimizedDb.pathToDatabaseFile, this->pathToDatabaseFile);
+        std::filesystem::rename(optimizedPath, this->pathToDatabaseFile);
     } catch (const std::filesystem::filesystem_error& e) {
         std::cerr << "Error: " << e.what() << '\n';
     }
+    // page ids changed with the new file
+    this->rightmostLeaf.valid = false;
+    this->defragCursor = 0;
+    this->DetachSnapshots();
 
     try {
         std::filesystem::remove(this->name + "Old.db");
-        std::filesystem::remove_all(OptimizedDb.wal.walDirectory);
+        std::filesystem::remove_all(optimizedWalDirectory);
     } catch (const std::filesystem::filesystem_error& e) {
         std::cerr << "Error deleting file: " << e.what() << '\n';
     }
@@ -1364,39 +1571,78 @@ void Database::Optimize(){
 }
 
 bool Database::RecoverFromWal() {
-    auto records = this->wal.ReadAll();
-    if (records.empty()) {
+    std::unique_lock<std::shared_mutex> lock(this->treeMutex);
+    MetaPage Meta = this->ReadMetaPage();
+    uint64_t checkpointLSN = Meta.Header()->checkpointLSN;
+    uint64_t lsnBase = Meta.Header()->lsnBase;
+
+    // Tik įrašai po paskutinio checkpoint'o gali būti neįrašyti į puslapius.
+    // Segmentai dekoduojami lygiagrečiai, o įrašai taikomi medžiui LSN tvarka, kol dekoduojami kiti.
+    WalReader reader = this->wal.OpenReader(checkpointLSN, WalReader::DefaultParallelism());
+    WalRecord record;
+    if (!reader.Next(record)) {
         return true;
     }
 
     bool allSuccess = true; // Tik tam, kad patikrinti ar visi įrašai iš WAL sėkmingai įsirašė į B+ medį.
     uint64_t maxLsn = 0;
+    size_t applied = 0;
+    size_t recordCount = 0;
 
-    std::cout << "RecoverFromWal: Applying " << records.size() << " records...\n";
+    // Įrašai skaitomi po vieną, todėl atmintis nepriklauso nuo WAL dydžio.
+    do {
+        recordCount++;
+        maxLsn = std::max(maxLsn, record.lsn);
 
-    for (const auto &record : records) {
-        if (record.operation == WalOperation::SET) {
-            if(!this->Set(record.key, record.value)) {
-                std::cerr << "Failed to recover key: " << record.key << "\n";
-                allSuccess = false; // Pažymime, jog nepavyko įrašas.
-            }
-        } else if (record.operation == WalOperation::DELETE) {
-            this->Remove(record.key);
+        // Lapas jau turi šį (arba naujesnį) pakeitimą - praleidžiam.
+        if (this->GetLeafPageLSN(record.key) >= lsnBase + record.lsn) {
+            continue;
         }
-    }
 
-    // Po recovery, atnaujiname MetaPage LSN.
-    if (allSuccess) {
-        uint64_t currentMetaLsn = this->getLSN();
-        if (maxLsn > currentMetaLsn) {
-            this->writeLSN(maxLsn);
+        try {
+            if (record.operation == WalOperation::SET) {
+                this->ApplySet(record.key, record.value, record.lsn);
+            } else if (record.operation == WalOperation::DELETE) {
+                this->ApplyRemove(record.key, record.lsn);
+            }
+            applied++;
         }
-        return true;
+        catch (const std::exception &e) {
+            std::cerr << "Failed to recover key: " << record.key << " (" << e.what() << ")\n";
+            allSuccess = false; // Pažymime, jog nepavyko įrašas.
+        }
+    } while (reader.Next(record));
+
+    std::cout << "RecoverFromWal: " << recordCount << " records after checkpoint " << checkpointLSN
+              << ", applied " << applied << "\n";
+
+    // Po recovery, atnaujiname MetaPage LSN (praleisti įrašai jo nepakeitė).
+    Meta = this->ReadMetaPage();
+    if (maxLsn > Meta.Header()->lastSequenceNumber) {
+        Meta.Header()->lastSequenceNumber = maxLsn;
+        this->UpdateMetaPage(Meta);
     }
 
-    std::cerr << "CRITICAL: Recovery partially failed.\n";
-    return false;
+    if (!allSuccess) {
+        std::cerr << "CRITICAL: Recovery partially failed.\n";
+    }
+    return allSuccess;
+}
 
+/**
+ * @brief Finds the leaf where key belongs and returns its page LSN. Caller holds the tree lock.
+ *
+ * @param key
+ * @return pageLSN of the leaf
+ */
+uint64_t Database::GetLeafPageLSN(const string &key) const {
+    MetaPage Meta = this->ReadMetaPage();
+    BasicPage currentPage = this->ReadPage(Meta.Header()->rootPageID);
+    while (!currentPage.Header()->isLeaf){
+        InternalPage internal(currentPage);
+        currentPage = this->ReadPage(internal.FindPointerByKey(key));
+    }
+    return currentPage.Header()->pageLSN;
 }
 
 /**
@@ -1405,24 +1651,25 @@ bool Database::RecoverFromWal() {
  * @param value. Rakto reikšmė.
 */
 uint64_t Database::ExecuteLogSetWithLSN(const string &key, const string &value) {
-    // 1. Rašome į WAL.
-    if (!this->wal.LogSet(key, value)) {
+    // WAL ir medis keičiami po tuo pačiu lock'u, kad puslapiai gautų pakeitimus LSN tvarka.
+    std::unique_lock<std::shared_mutex> lock(this->treeMutex);
+
+    // 1. Rašome į WAL (WAL priskiria naują LSN).
+    WalRecord walRecord(0, WalOperation::SET, key, value);
+    if (!this->wal.Append(walRecord, true)) {
         std::cerr << "Critical Error: Failed to write to WAL during Set.\n";
         return 0;
     }
 
-    // 2. Rašome į B+ medį.
-    if (!this->Set(key, value)) {
+    // 2. Naujas LSN iš WAL.
+    auto newLsn = walRecord.lsn;
+
+    // 3. Rašome į B+ medį (kartu ir naują LSN į MetaPageHeader).
+    if (!this->ApplySet(key, value, newLsn)) {
         std::cerr << "Error: WAL written but B+Tree Set failed.\n";
         return 0;
     }
 
-    // 3. Gauname naują LSN iš WAL.
-    auto newLsn = this->wal.GetCurrentSequenceNumber();
-
-    // 4. Rašome naują LSN į MetaPageHeader LSN.
-    this->writeLSN(newLsn);
-
     return newLsn;
 }
 
@@ -1431,68 +1678,305 @@ uint64_t Database::ExecuteLogSetWithLSN(const string &key, const string &value)
  * @param key. Raktas, kuris trinamas.
 */
 uint64_t Database::ExecuteLogDeleteWithLSN(const string &key) {
-    // 1. Rašome į WAL.
-    if (!this->wal.LogDelete(key)) {
+    std::unique_lock<std::shared_mutex> lock(this->treeMutex);
+
+    // 1. Rašome į WAL (WAL priskiria naują LSN).
+    WalRecord walRecord(0, WalOperation::DELETE, key);
+    if (!this->wal.Append(walRecord, true)) {
         std::cerr << "Critical Error: Failed to write to WAL during Delete.\n";
         return 0;
     }
 
-    // 2. Triname iš B+ medžio.
-    this->Remove(key);
+    // 2. Naujas LSN iš WAL.
+    auto newLsn = walRecord.lsn;
 
-    // 3. Gauname naują LSN iš WAL.
-    auto newLsn = this->wal.GetCurrentSequenceNumber();
-
-    // 4. Rašome naują LSN į MetaPageHeader LSN.
-    this->writeLSN(newLsn);
+    // 3. Triname iš B+ medžio (kartu ir naujas LSN į MetaPageHeader).
+    this->ApplyRemove(key, newLsn);
 
     return newLsn;
 }
 
 /**
- * @brief Atliekama specifinė operacija, su specifiniu LSN.
- * Turėtų naudoti FOLLOWER'is, kad matchintų LEADER'į.
+ * @brief Įrašo follower'iui atsiųstą įrašą (su leader'io LSN) į WAL, medžio nekeičia - tai daro ApplyReplicatedBatch.
+ * Follower'io WAL'ą rašo tik replikacijos thread'as, todėl tree lock'as nereikalingas ir applier'is jo nestabdo.
+ * Per dideli įrašai atmetami dar prieš WAL (std::length_error, kaip ApplySet).
 */
-bool Database::ApplyReplication(WalRecord walRecord) {
-    // 1. Rašome į WAL su specifiniu LSN (nuo leader'io)
+bool Database::LogReplicated(WalRecord &walRecord) {
+    if (walRecord.key.length() > MAX_KEY_LENGTH) {
+        throw std::length_error("Key is too long! (max size: 255)");
+    }
+    if (walRecord.operation == WalOperation::SET && walRecord.value.length() > MAX_VALUE_LENGTH) {
+        throw std::length_error("Value is too long! (max size: 2048)");
+    }
+
     if (!this->wal.LogWithLSN(walRecord)) {
         std::cerr << "Follower Error: Failed to write replication record to WAL.\n";
         return false;
     }
+    return true;
+}
 
-    // 2. Rašome į B+ medį.
-    bool success;
-    if (walRecord.operation == WalOperation::SET) {
-        success = this->Set(walRecord.key, walRecord.value);
-    } else {
-        this->Remove(walRecord.key);
-        success = true;
+/**
+ * @brief Pritaiko medžiui jau WAL'e esančius replikacijos įrašus (LSN tvarka, be tarpų tarp paketų) po vienu tree lock'u.
+ * Įrašai grupuojami pagal raktą: kiekvienam raktui pritaikomas tik paskutinis paketo įrašas, raktų tvarka (lapų lokalumas).
+ * Kadangi paketo viduje tvarka ne LSN, puslapiai žymimi watermark'u (LSN prieš paketą - viskas iki jo pritaikyta),
+ * o MetaPageHeader lastSequenceNumber pakeliamas tik pritaikius visą paketą. Recovery tada paketo įrašus kartoja LSN tvarka.
+ * @return pritaikytų įrašų skaičius (nepavykęs įrašas praleidžiamas, kaip ir recovery metu)
+*/
+size_t Database::ApplyReplicatedBatch(const vector<WalRecord> &records) {
+    if (records.empty()) {
+        return 0;
     }
 
-    // 3. Rašome naują LSN į MetaPageHeader LSN.
-    if (success) {
-        this->writeLSN(walRecord.lsn);
+    vector<const WalRecord *> byKey;
+    byKey.reserve(records.size());
+    for (const auto &record : records) {
+        byKey.push_back(&record);
+    }
+    // stable - to paties rakto įrašai lieka LSN tvarka
+    std::stable_sort(byKey.begin(), byKey.end(), [](const WalRecord *left, const WalRecord *right) {
+        return left->key < right->key;
+    });
+
+    uint64_t watermark = records.front().lsn - 1;
+    uint64_t batchLsn = records.back().lsn;
+
+    std::unique_lock<std::shared_mutex> lock(this->treeMutex);
+    size_t applied = 0;
+    for (size_t i = 0; i < byKey.size(); i++) {
+        const WalRecord &record = *byKey[i];
+        if (i + 1 < byKey.size() && byKey[i + 1]->key == record.key) {
+            continue; // vėlesnis to paties rakto įrašas jį perrašo
+        }
+        try {
+            if (record.operation == WalOperation::SET) {
+                this->ApplySet(record.key, record.value, watermark);
+            } else {
+                this->ApplyRemove(record.key, watermark);
+            }
+            applied++;
+        } catch (const std::exception &e) {
+            std::cerr << "Failed to apply replicated LSN " << record.lsn << " (" << e.what() << ")\n";
+        }
     }
 
-    return true;
+    MetaPage Meta = this->ReadMetaPage();
+    if (batchLsn > Meta.Header()->lastSequenceNumber) {
+        Meta.Header()->lastSequenceNumber = batchLsn;
+        this->UpdateMetaPage(Meta);
+    }
+    return applied;
+}
+
+/**
+ * @brief Waits until WAL record with given LSN is durable (according to WAL sync policy).
+ * Called after the tree lock is released, so writers waiting for the same fdatasync do not block each other.
+ *
+ * @param lsn
+ * @return true if record is durable
+ */
+bool Database::WaitWalDurable(uint64_t lsn) {
+    return this->wal.WaitDurable(lsn);
+}
+
+/**
+ * @brief Sets when WAL records become durable (see WalSyncPolicy)
+ *
+ */
+void Database::ConfigureWalSync(WalSyncPolicy policy, std::chrono::microseconds groupDelay, std::chrono::milliseconds interval) {
+    this->wal.SetSyncPolicy(policy, groupDelay, interval);
+}
+
+/**
+ * @brief Fuzzy checkpoint. Flushes pages to disk and records checkpointLSN in the meta page.
+ * Writers are only blocked while the meta page is updated, fsync runs without the tree lock.
+ *
+ * @return checkpoint LSN (every change up to it is on disk)
+ */
+uint64_t Database::Checkpoint() {
+    // 1. Pages are written under the tree lock, so every change up to lastSequenceNumber is already in the file.
+    // Checkpoint can not get ahead of durable WAL, otherwise LSNs after it could be lost and reused.
+    uint64_t checkpointLSN = 0;
+    uint64_t lsnBase = 0;
+    {
+        std::shared_lock<std::shared_mutex> lock(this->treeMutex);
+        MetaPage Meta = this->ReadMetaPage();
+        checkpointLSN = std::min(Meta.Header()->lastSequenceNumber, this->wal.GetDurableLsn());
+        lsnBase = Meta.Header()->lsnBase;
+    }
+
+    // 2. Flush them. Changes made meanwhile have bigger LSNs and are not covered by this checkpoint
+    this->SyncDatabaseFile();
+
+    // 3. Record checkpoint (unless WAL was reset or a snapshot was installed in the meantime)
+    {
+        std::unique_lock<std::shared_mutex> lock(this->treeMutex);
+        MetaPage Meta = this->ReadMetaPage();
+        if (Meta.Header()->lsnBase != lsnBase || checkpointLSN <= Meta.Header()->checkpointLSN ||
+            checkpointLSN > Meta.Header()->lastSequenceNumber) {
+            return Meta.Header()->checkpointLSN;
+        }
+        Meta.Header()->checkpointLSN = checkpointLSN;
+        this->UpdateMetaPage(Meta);
+    }
+
+    // 4. Make the checkpoint record itself durable
+    this->SyncDatabaseFile();
+    return checkpointLSN;
+}
+
+/**
+ * @brief Drops WAL segments that only hold records up to upToLsn. Never goes past the last checkpoint.
+ * Dropped segments are only detached here, RecycleWalSegments zeroes them for reuse.
+ *
+ * @param upToLsn records that are no longer needed (e.g. acknowledged by every follower)
+ * @return true on success
+ */
+bool Database::TruncateWal(uint64_t upToLsn) {
+    // shared lock only keeps ResetLogState away, appends go to the current segment which is never removed
+    std::shared_lock<std::shared_mutex> lock(this->treeMutex);
+    uint64_t checkpointLSN = this->ReadMetaPage().Header()->checkpointLSN;
+    return this->wal.ClearUpTo(std::min(upToLsn, checkpointLSN));
+}
+
+/**
+ * @brief Zeroes WAL segments detached by TruncateWal and keeps them for reuse. Slow (a full segment is rewritten),
+ * so it takes no tree lock and callers should not hold their own locks either.
+ */
+void Database::RecycleWalSegments() {
+    this->wal.RecycleSegments();
+}
+
+/**
+ * @brief Compacts closed WAL segments: only the newest record of every key is kept, so follower catch-up
+ * sends less. Current segment and appends are not affected.
+ *
+ * @param maxSegments how many segments to merge at most
+ * @return number of records dropped
+ */
+size_t Database::CompactWal(size_t maxSegments) {
+    std::shared_lock<std::shared_mutex> lock(this->treeMutex);
+    return this->wal.CompactSegments(maxSegments);
+}
+
+/**
+ * @brief Opens a point-in-time snapshot of the database file for a follower that can not catch up from the WAL.
+ * Writers are blocked only while the meta page is read. The snapshot is consistent at lastSequenceNumber and its
+ * meta page has checkpointLSN = lastSequenceNumber, so after installing it the follower continues from that LSN.
+ *
+ * @return snapshot, pages are read with PageSnapshot::ReadPages
+ */
+std::unique_ptr<PageSnapshot> Database::OpenSnapshot() {
+    std::unique_ptr<PageSnapshot> snapshot(new PageSnapshot(this));
+    std::unique_lock<std::shared_mutex> lock(this->treeMutex);
+
+    snapshot->preImagePath = this->pathToDatabaseFile.string() + ".preimage" + std::to_string(++this->snapshotCounter);
+    snapshot->databaseFd = ::open(this->pathToDatabaseFile.c_str(), O_RDONLY);
+    snapshot->preImageFd = ::open(snapshot->preImagePath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (snapshot->databaseFd < 0 || snapshot->preImageFd < 0) {
+        throw std::runtime_error("Failed to open files for snapshot");
+    }
+
+    // Pages are written under the tree lock, so every change up to lastSequenceNumber is already in the file
+    MetaPage Meta = this->ReadMetaPage();
+    snapshot->lsn = Meta.Header()->lastSequenceNumber;
+    snapshot->pageCount = Meta.Header()->lastPageID + 1;
+    Meta.Header()->checkpointLSN = snapshot->lsn;
+    snapshot->metaPage.assign(Meta.mData, Page::PAGE_SIZE);
+
+    this->activeSnapshots.push_back(snapshot.get());
+    return snapshot;
+}
+
+/**
+ * @brief File the follower writes received snapshot pages to (data/<name>.snapshot)
+ *
+ */
+fs::path Database::GetSnapshotInstallPath() const {
+    return this->pathToDatabaseFile.parent_path() / (this->name + ".snapshot");
 }
 
 /**
- * @brief Retrieves all WAL records with an LSN greater than the provided lsn.
- * Used by Leader to sync new Followers.
+ * @brief Replaces the database file with the snapshot in GetSnapshotInstallPath(). WAL is cleared and continues
+ * from snapshotLsn, because its records belong to the replaced file.
+ *
+ * @param snapshotLsn LSN the snapshot was taken at
+ * @return true on success, false if the snapshot file is incomplete (database is not changed)
  */
-vector<WalRecord> Database::GetWalRecordsSince(uint64_t lastKnownLsn) {
-    // 1. Read all records from WAL file
-    auto allRecords = this->wal.ReadAll();
+bool Database::InstallSnapshot(uint64_t snapshotLsn) {
+    fs::path snapshotPath = this->GetSnapshotInstallPath();
+    {
+        ifstream snapshotFile(snapshotPath.string(), ios::in | ios::binary);
+        MetaPage Meta;
+        snapshotFile.read(Meta.mData, Page::PAGE_SIZE);
+        if (!snapshotFile || Meta.Header()->lastSequenceNumber != snapshotLsn ||
+            fs::file_size(snapshotPath) != static_cast<uintmax_t>(Meta.Header()->lastPageID + 1) * Page::PAGE_SIZE) {
+            std::cerr << "InstallSnapshot: incomplete snapshot file " << snapshotPath << "\n";
+            return false;
+        }
+    }
 
-    // 2. Filter records that are newer than lastKnownLsn
-    vector<WalRecord> newRecords;
-    for (const auto& record : allRecords) {
-        if (record.lsn > lastKnownLsn) {
-            newRecords.push_back(record);
+    int fd = ::open(snapshotPath.c_str(), O_RDWR);
+    if (fd < 0 || ::fsync(fd) != 0) {
+        if (fd >= 0) {
+            ::close(fd);
         }
+        throw std::runtime_error("fsync failed for snapshot file");
+    }
+    ::close(fd);
+
+    std::unique_lock<std::shared_mutex> lock(this->treeMutex);
+
+    // WAL first: after a crash old records must not be replayed on the new pages
+    if (!this->wal.ClearAll()) {
+        std::cerr << "CRITICAL: Failed to clear WAL before installing snapshot!\n";
+        return false;
     }
-    return newRecords;
+    fs::rename(snapshotPath, this->pathToDatabaseFile);
+    this->SyncDatabaseFile();
+
+    this->rightmostLeaf.valid = false;
+    this->defragCursor = 0;
+    this->DetachSnapshots();
+    this->wal.Rebase(snapshotLsn);
+
+    cout << "[Database] Snapshot installed. LSN is now " << snapshotLsn << ".\n";
+    return true;
+}
+
+/**
+ * @brief Database file was replaced (Optimize, InstallSnapshot). Caller holds the exclusive tree lock.
+ * Open snapshots keep reading the old file, which no longer changes.
+ */
+void Database::DetachSnapshots() {
+    for (PageSnapshot *snapshot : this->activeSnapshots) {
+        snapshot->fileReplaced = true;
+    }
+}
+
+/**
+ * @brief fsync database file
+ *
+ */
+void Database::SyncDatabaseFile() const {
+    int fd = ::open(this->pathToDatabaseFile.c_str(), O_RDWR);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open database file for fsync");
+    }
+    int result = ::fsync(fd);
+    ::close(fd);
+    if (result != 0) {
+        throw std::runtime_error("fsync failed for database file");
+    }
+}
+
+/**
+ * @brief Opens a reader over WAL records with an LSN greater than the provided lsn.
+ * Used by Leader to sync new Followers, records are streamed one at a time.
+ */
+WalReader Database::OpenWalReader(uint64_t lastKnownLsn) {
+    // WAL indeksas praleidžia senesnius segmentus ir peršoka prie lastKnownLsn vietos segmente.
+    return this->wal.OpenReader(lastKnownLsn, WalReader::DefaultParallelism());
 }
 
 
@@ -1500,13 +1984,20 @@ vector<WalRecord> Database::GetWalRecordsSince(uint64_t lastKnownLsn) {
  @brief Išvalo visus WAL failus ir resetinna MetaPageHeader'į.
 */
 void Database::ResetLogState() {
+    std::unique_lock<std::shared_mutex> lock(this->treeMutex);
+
     // 1. Išvalom visus WAL failus.
     if (!this->wal.ClearAll()) {
         std::cerr << "CRITICAL: Failed to clear WAL during reset!\n";
     }
 
-    // 2. Nustatom MetaPageHeader'io LSN į 0.
-    this->writeLSN(0);
+    // 2. Nustatom MetaPageHeader'io LSN į 0. Puslapių LSN lieka, todėl lsnBase padidinam,
+    // kad nauji LSN (nuo 1) puslapiuose vis tiek būtų didesni už senus.
+    MetaPage Meta = this->ReadMetaPage();
+    Meta.Header()->lsnBase += Meta.Header()->lastSequenceNumber;
+    Meta.Header()->lastSequenceNumber = 0;
+    Meta.Header()->checkpointLSN = 0;
+    this->UpdateMetaPage(Meta);
 
     cout << "[Database] Log state reset. LSN is now 0.\n";
 }
@@ -1517,6 +2008,7 @@ void Database::ResetLogState() {
  * @return uint64_t LSN
  */
 uint64_t Database::getLSN(){
+    std::shared_lock<std::shared_mutex> lock(this->treeMutex);
     MetaPage Meta;
     try {
         Meta = this->ReadMetaPage();
@@ -1528,6 +2020,24 @@ uint64_t Database::getLSN(){
     return Meta.Header()->lastSequenceNumber;
 }
 
+/**
+ * @brief Gets lsnBase from Meta page. Nodes with different lsnBase have different LSN histories.
+ *
+ * @return uint64_t lsnBase
+ */
+uint64_t Database::getLsnBase(){
+    std::shared_lock<std::shared_mutex> lock(this->treeMutex);
+    return this->ReadMetaPage().Header()->lsnBase;
+}
+
+/**
+ * @brief Oldest LSN still in the WAL. A follower that needs older records has to get a snapshot.
+ *
+ */
+uint64_t Database::GetWalFirstLsn() {
+    return this->wal.GetFirstLsn();
+}
+
 /**
  * @brief Writes LSN to MetaPage
  *
@@ -1535,6 +2045,7 @@ uint64_t Database::getLSN(){
  * @return
  */
 bool Database::writeLSN(uint64_t LSNToWrite) {
+    std::unique_lock<std::shared_mutex> lock(this->treeMutex);
     MetaPage Meta;
     try {
         Meta = this->ReadMetaPage();
@@ -1560,6 +2071,7 @@ bool Database::writeLSN(uint64_t LSNToWrite) {
  *
  */
 void Database::CoutDatabase() const {
+    std::shared_lock<std::shared_mutex> lock(this->treeMutex);
     MetaPage Meta = ReadMetaPage();
     Meta.Header()->CoutHeader();
     uint32_t pagenum = Meta.Header()->lastPageID;
@@ -1575,3 +2087,75 @@ void Database::CoutDatabase() const {
         }
     }
 }
+
+// ---------------- PageSnapshot ----------------
+PageSnapshot::~PageSnapshot() {
+    {
+        std::unique_lock<std::shared_mutex> lock(this->database->treeMutex);
+        auto &snapshots = this->database->activeSnapshots;
+        snapshots.erase(std::remove(snapshots.begin(), snapshots.end(), this), snapshots.end());
+    }
+    if (this->databaseFd >= 0) {
+        ::close(this->databaseFd);
+    }
+    if (this->preImageFd >= 0) {
+        ::close(this->preImageFd);
+    }
+    std::error_code error;
+    fs::remove(this->preImagePath, error);
+}
+
+/**
+ * @brief Appends up to maxPages next pages (Page::PAGE_SIZE each, meta page first) to out.
+ * Holds the shared tree lock while reading, so writers wait for at most one chunk.
+ *
+ * @return number of pages appended, 0 when every page was read
+ */
+uint32_t PageSnapshot::ReadPages(string &out, uint32_t maxPages) {
+    std::shared_lock<std::shared_mutex> lock(this->database->treeMutex);
+    if (this->failed) {
+        throw std::runtime_error("Snapshot failed: old page could not be preserved");
+    }
+
+    uint32_t pages = 0;
+    while (pages < maxPages && this->nextPage < this->pageCount) {
+        size_t position = out.size();
+        out.resize(position + Page::PAGE_SIZE);
+        if (this->nextPage == 0) {
+            memcpy(&out[position], this->metaPage.data(), Page::PAGE_SIZE);
+        } else {
+            // page changed after the snapshot was taken - its old version is in the pre-image file
+            auto preImage = this->preImageOffsets.find(this->nextPage);
+            bool ok = (preImage != this->preImageOffsets.end())
+                ? ReadAt(this->preImageFd, &out[position], Page::PAGE_SIZE, preImage->second)
+                : ReadAt(this->databaseFd, &out[position], Page::PAGE_SIZE, static_cast<uint64_t>(this->nextPage) * Page::PAGE_SIZE);
+            if (!ok) {
+                throw std::runtime_error("Failed to read page " + std::to_string(this->nextPage) + " for snapshot");
+            }
+        }
+        this->nextPage++;
+        pages++;
+    }
+    return pages;
+}
+
+/**
+ * @brief Called by WriteBasicPage (exclusive tree lock) before pageID is overwritten.
+ * Copies the old page to the pre-image file if the snapshot still has to read it.
+ */
+void PageSnapshot::PreserveOldPage(uint32_t pageID) {
+    if (this->fileReplaced || this->failed || pageID == 0 || pageID < this->nextPage || pageID >= this->pageCount ||
+        this->preImageOffsets.count(pageID) != 0) {
+        return;
+    }
+
+    // writers are not failed because of a snapshot, the snapshot fails instead
+    char page[Page::PAGE_SIZE];
+    if (!ReadAt(this->databaseFd, page, Page::PAGE_SIZE, static_cast<uint64_t>(pageID) * Page::PAGE_SIZE) ||
+        !WriteAt(this->preImageFd, page, Page::PAGE_SIZE, this->preImageSize)) {
+        this->failed = true;
+        return;
+    }
+    this->preImageOffsets[pageID] = this->preImageSize;
+    this->preImageSize += Page::PAGE_SIZE;
+}
@@ -13,12 +13,13 @@
 InternalPage::InternalPage(uint32_t pageID) {
     PageHeader pageHeader{};
     pageHeader.pageID = pageID;
-    pageHeader.parentPageID = 0;
     pageHeader.isLeaf = false;
     pageHeader.numberOfCells = 0;
     pageHeader.offsetToEndOfFreeSpace = InternalPage::PAGE_SIZE-(2 * sizeof(uint32_t));
     pageHeader.offsetToStartOfFreeSpace = sizeof(PageHeader);
     pageHeader.offsetToStartOfSpecialSpace = PAGE_SIZE-(2 * sizeof(uint32_t));
+    pageHeader.deadBytes = 0;
+    pageHeader.pageLSN = 0;
     std::memcpy(mData, &pageHeader, sizeof(PageHeader));
     std::memset(this->Special1(), 0, sizeof(uint32_t)); // last child pointer
     std::memset(this->Special2(), 0, sizeof(uint32_t)); // empty
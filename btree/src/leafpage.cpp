@@ -11,57 +11,96 @@
 LeafPage::LeafPage(uint32_t pageID) {
     PageHeader pageHeader{};
     pageHeader.pageID = pageID;
-    pageHeader.parentPageID = 0;
     pageHeader.isLeaf = true;
     pageHeader.numberOfCells = 0;
     pageHeader.offsetToEndOfFreeSpace = LeafPage::PAGE_SIZE-(2 * sizeof(uint32_t));
     pageHeader.offsetToStartOfFreeSpace = sizeof(PageHeader);
     pageHeader.offsetToStartOfSpecialSpace = LeafPage::PAGE_SIZE-(2 * sizeof(uint32_t));
+    pageHeader.deadBytes = 0;
+    pageHeader.pageLSN = 0;
     std::memcpy(mData, &pageHeader, sizeof(PageHeader));
     std::memset(this->Special1(), 0, sizeof(uint32_t)); // pointer to previous leaf
     std::memset(this->Special2(), 0, sizeof(uint32_t)); // pointer to next leaf
 }
 
 /**
- * @brief Insert key:value pair into LeafPage
+ * @brief Insert or update key:value pair in LeafPage with a single binary search
  *
  * @param key key to insert
  * @param value value to insert
- * @details Deserializes key and value strings. Copies them into end of the page. Inserts an offset to them into offset array (in sorted manner, binary search)
- * @returns true if new key was added and false if no key was added
+ * @details If the key exists and the new value fits into the old cell, value is overwritten in place.
+ * Otherwise serialized key and value are copied into end of the page and offset to them is put (or replaced) in the offset array.
+ * Bytes of the old cell are counted as dead space in the header.
+ * @returns INSERTED if new key was added, UPDATED if existing key was rewritten, NO_SPACE if nothing was changed
  */
-bool LeafPage::InsertKeyValue(string key, string value) {
+InsertResult LeafPage::InsertKeyValue(const string &key, const string &value) {
 
     uint16_t keyLength = key.length();
     uint16_t valueLength = value.length();
     uint16_t cellLength = keyLength + valueLength + sizeof(keyLength) + sizeof(valueLength);
-    uint16_t offset = Header()->offsetToEndOfFreeSpace - cellLength;
-    bool newKey = true;
 
-    //check if it fits
-    if (this->FreeSpace() < cellLength + sizeof(offset) ) {
-        return false;
+    // find position of the key (or where it should be inserted)
+    uint16_t position = FindInsertPosition(key);
+    bool keyExists = position < Header()->numberOfCells && GetKey(Offsets()[position]) == key;
+
+    if (keyExists) {
+        uint16_t oldOffset = Offsets()[position];
+        auto *pValueLength = mData + oldOffset + sizeof(keyLength) + keyLength;
+        uint16_t oldValueLength = 0;
+        memcpy(&oldValueLength, pValueLength, sizeof(oldValueLength));
+
+        // new value fits into the old cell - overwrite in place
+        if (valueLength <= oldValueLength) {
+            memcpy(pValueLength, &valueLength, sizeof(valueLength));
+            memcpy(pValueLength + sizeof(valueLength), value.data(), valueLength);
+            Header()->deadBytes += oldValueLength - valueLength;
+            return InsertResult::UPDATED;
+        }
+
+        // doesnt fit into old cell - write new cell and repoint the offset (no new offset needed)
+        if (this->FreeSpace() < cellLength) {
+            return InsertResult::NO_SPACE;
+        }
+        uint16_t offset = Header()->offsetToEndOfFreeSpace - cellLength;
+        Offsets()[position] = offset;
+        Header()->offsetToEndOfFreeSpace -= cellLength;
+        Header()->deadBytes += sizeof(keyLength) + keyLength + sizeof(oldValueLength) + oldValueLength;
+        WriteCell(offset, key, value);
+        return InsertResult::UPDATED;
     }
 
-    // check if key value pair already exists and remove it so it will be rewritten
-    auto cell = this->FindKey(key);
-    if (cell.has_value()) {
-        this->RemoveKey(key);
-        newKey = false;
+    //check if it fits
+    uint16_t offset = Header()->offsetToEndOfFreeSpace - cellLength;
+    if (this->FreeSpace() < cellLength + sizeof(offset) ) {
+        return InsertResult::NO_SPACE;
     }
 
     //insert in sorted manner
-    uint16_t positionToInsert = FindInsertPosition(key);
-
-    for (int i = Header()->numberOfCells; i > positionToInsert; i--) {
+    for (int i = Header()->numberOfCells; i > position; i--) {
         Offsets()[i] = Offsets()[i-1];
     }
-    Offsets()[positionToInsert] = offset;
+    Offsets()[position] = offset;
     // update metadata
     Header()->offsetToStartOfFreeSpace += sizeof(offset);
     Header()->offsetToEndOfFreeSpace -= cellLength;
 
     // insert serialized new key value pair
+    WriteCell(offset, key, value);
+
+    Header()->numberOfCells++;
+    return InsertResult::INSERTED;
+}
+
+/**
+ * @brief Serializes key value pair into the page at given offset
+ *
+ * @param offset
+ * @param key
+ * @param value
+ */
+void LeafPage::WriteCell(uint16_t offset, const string &key, const string &value) {
+    uint16_t keyLength = key.length();
+    uint16_t valueLength = value.length();
     auto *pCurrentPosition = mData + offset;
 
     memcpy(pCurrentPosition, &keyLength, sizeof(keyLength));
@@ -74,9 +113,6 @@ bool LeafPage::InsertKeyValue(string key, string value) {
     pCurrentPosition += sizeof(valueLength);
 
     memcpy(pCurrentPosition, value.data(), valueLength);
-
-    Header()->numberOfCells++;
-    return newKey;
 }
 
 bool LeafPage::WillFit(const string &key, const string &value){
@@ -88,6 +124,21 @@ bool LeafPage::WillFit(const string &key, const string &value){
     return this->FreeSpace() >= cellLength + sizeof(offset);
 }
 
+/**
+ * @brief Checks if the key value pair would fit after the page is optimized (dead bytes reclaimed)
+ *
+ * @param key
+ * @param value
+ * @return
+ */
+bool LeafPage::WillFitAfterOptimize(const string &key, const string &value){
+    uint16_t keyLength = key.length();
+    uint16_t valueLength = value.length();
+    uint16_t cellLength = keyLength + valueLength + sizeof(keyLength) + sizeof(valueLength);
+
+    return this->FreeSpace() + this->Header()->deadBytes >= static_cast<int>(cellLength + sizeof(uint16_t));
+}
+
 /**
  * @brief Gets key value pair by offset. Deserializes
  *
@@ -112,6 +163,18 @@ leafNodeCell LeafPage::GetKeyValue(uint16_t offset) {
     return {key, value};
 }
 
+/**
+ * @brief Gets only the key by offset without copying it
+ *
+ * @param offset offset to keyvalue pair
+ * @return std::string_view pointing into page's data (valid while page is alive)
+ */
+std::string_view LeafPage::GetKey(uint16_t offset) {
+    uint16_t keyLength = 0;
+    std::memcpy(&keyLength, mData + offset, sizeof(keyLength));
+    return {mData + offset + sizeof(keyLength), keyLength};
+}
+
 /**
  * @brief Searches for the key in the page and returns key and value if found. Else returns nothing
  *
@@ -119,22 +182,11 @@ leafNodeCell LeafPage::GetKeyValue(uint16_t offset) {
  * @return leafNodeCell(key:value pair) struct or nullopt(null)
  */
 std::optional<leafNodeCell> LeafPage::FindKey(const string &key){
-    int low = 0;
-    int high = Header()->numberOfCells - 1;
-    while (low <= high) {
-        int mid = low + ((high - low) / 2);
-
-        if (GetKeyValue(Offsets()[mid]).key == key) {
-            return GetKeyValue(Offsets()[mid]);
-        }
-
-        if (GetKeyValue(Offsets()[mid]).key < key) {
-            low = mid + 1;
-        } else {
-            high = mid - 1;
-        }
+    int16_t index = FindKeyIndex(key);
+    if (index == -1) {
+        return std::nullopt;
     }
-    return std::nullopt;
+    return GetKeyValue(Offsets()[index]);
 }
 
 /**
@@ -148,7 +200,7 @@ uint16_t LeafPage::FindInsertPosition(const std::string& key) {
     auto *end = Offsets() + Header()->numberOfCells;
 
     auto *it = std::lower_bound(begin, end, key, [&](uint16_t offset, const std::string& k) {
-        return GetKeyValue(offset).key < k;
+        return GetKey(offset) < k;
     });
 
     return static_cast<uint16_t>(it - begin);
@@ -165,12 +217,13 @@ int16_t LeafPage::FindKeyIndex(const string& key) {
     int high = Header()->numberOfCells - 1;
     while (low <= high) {
         int mid = low + ((high - low) / 2);
+        auto midKey = GetKey(Offsets()[mid]);
 
-        if (GetKeyValue(Offsets()[mid]).key == key) {
+        if (midKey == key) {
             return mid;
         }
 
-        if (GetKeyValue(Offsets()[mid]).key < key) {
+        if (midKey < key) {
             low = mid + 1;
         } else {
             high = mid - 1;
@@ -181,19 +234,27 @@ int16_t LeafPage::FindKeyIndex(const string& key) {
 
 /**
  * @brief Lazy deletion of key from the page. Doesn actually removes the key value pair, only offset to them.
+ * Bytes of removed cell are counted as dead space.
  *
  * @param key
+ * @return true if key was found and removed
  */
-void LeafPage::RemoveKey(const string &key){
+bool LeafPage::RemoveKey(const string &key){
     int16_t index = FindKeyIndex(key);
     if (index == -1) {
-        return;
+        return false;
     }
+    uint16_t offset = Offsets()[index];
+    uint16_t keyLength = GetKey(offset).length();
+    uint16_t valueLength = 0;
+    memcpy(&valueLength, mData + offset + sizeof(keyLength) + keyLength, sizeof(valueLength));
+    Header()->deadBytes += sizeof(keyLength) + keyLength + sizeof(valueLength) + valueLength;
+
     for (int i = index; i < Header()->numberOfCells - 1; i++) {
         Offsets()[i] = Offsets()[i + 1];
     }
     Header()->numberOfCells--;
-
+    return true;
 }
 
 /**
@@ -211,9 +272,9 @@ LeafPage LeafPage::Optimize(){
         auto cell = this->GetKeyValue(this->Offsets()[i]);
         OptimizedLeaf.InsertKeyValue(cell.key, cell.value);
     }
-    OptimizedLeaf.Header()->parentPageID = this->Header()->parentPageID;
     memcpy(OptimizedLeaf.Special1(), this->Special1(), sizeof(*this->Special1()));
     memcpy(OptimizedLeaf.Special2(), this->Special2(), sizeof(*this->Special2()));
+    OptimizedLeaf.Header()->pageLSN = this->Header()->pageLSN;
     return OptimizedLeaf;
 }
 /**
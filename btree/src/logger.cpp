@@ -1,10 +1,17 @@
 #include <algorithm>
 #include <cstdint>
 #include <stdexcept>
+#include <unordered_map>
 #include <utility>
 #include <iostream>
 #include <sstream>
 #include "../include/logger.hpp"
+#include "../include/crc32c.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using std::ios;
 using std::ifstream;
@@ -12,17 +19,47 @@ using std::getline;
 using std::istringstream;
 
 namespace {
-// Helper: Replace \n with a placeholder (e.g., \0) to keep WAL on one line
-string EscapeValue(string value) {
-    for (auto &character : value) {
-        if (character == '\n') {
-            character = '\0';
+// Helper: write whole buffer at offset (pwrite() can be partial)
+bool PWriteAll(int fd, const char *data, size_t size, size_t offset) {
+    while (size > 0) {
+        ssize_t written = ::pwrite(fd, data, size, static_cast<off_t>(offset));
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
         }
+        data += written;
+        size -= static_cast<size_t>(written);
+        offset += static_cast<size_t>(written);
     }
-    return value;
+    return true;
+}
+
+// Helper: file identity (inode), 0 if the file does not exist
+uint64_t FileId(const fs::path &path) {
+    struct stat fileStat{};
+    return (::stat(path.c_str(), &fileStat) == 0) ? static_cast<uint64_t>(fileStat.st_ino) : 0;
 }
 
-// Helper: Restore \n from placeholder
+// Helper: segment header (MAGIC + VERSION) followed by END marker
+string SegmentHeaderWithEndMarker() {
+    string header(WalFormat::SEGMENT_HEADER_SIZE + WalFormat::END_MARKER_SIZE, '\0');
+    memcpy(header.data(), WalFormat::MAGIC, sizeof(WalFormat::MAGIC));
+    memcpy(header.data() + sizeof(WalFormat::MAGIC), &WalFormat::VERSION, sizeof(WalFormat::VERSION));
+    return header;
+}
+
+// Helper: fsync directory, so newly created segment files survive a crash
+void SyncDirectory(const fs::path &directory) {
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+// Helper: Restore \n from placeholder (old text segments)
 string UnescapeValue(string value) {
     for (auto &character : value) {
         if (character == '\0') {
@@ -37,8 +74,7 @@ WalRecord::WalRecord(uint64_t seqNum, WalOperation operation, string key, string
     : lsn(seqNum), operation(operation), key(std::move(key)), value(std::move(value)) {};
 
 WAL::WAL(const string &name, size_t MaxSegmentSizeBytes)
-    : name(name), currentSequenceNumber(0), currentSegmentNumber(0),
-      maxSegmentSize(MaxSegmentSizeBytes), currentSegmentSize(0) {
+    : name(name), maxSegmentSize(MaxSegmentSizeBytes), ring(new WalRingSlot[RING_CAPACITY]) {
 
 
     fs::path dataFolderName = "data";
@@ -47,42 +83,70 @@ WAL::WAL(const string &name, size_t MaxSegmentSizeBytes)
 
     fs::create_directories(this->walDirectory);
 
+    uint64_t segmentNumber = 0;
+    uint64_t lastLsn = 0;
     auto segments = this->GetAllSegments();
     if (!segments.empty()) {
-        uint64_t maxSegment = 0;
-        for (const auto &segPath : segments) {
-            string filename = segPath.filename().string();
-            size_t underscorePos = filename.find('_');
-            size_t dotPos = filename.find('.');
-
-            if (underscorePos != string::npos && dotPos != string::npos) {
-                uint64_t segNum = std::stoull(filename.substr(underscorePos + 1, dotPos - underscorePos - 1));
-                maxSegment = std::max(maxSegment, segNum);
+        // Segmentai surūšiuoti, paskutinis yra dabartinis.
+        segmentNumber = SegmentNumber(segments.back());
+        fs::path currentWalPath = segments.back();
+
+        // Skaitomas tik naujausias segmentas (galo nukirpimui ir paskutiniam LSN), todėl atidarymas nepriklauso nuo
+        // viso WAL dydžio. Senesni segmentai skaitomi tik jei naujesni tušti; kiti indeksuojami, kai jų prireikia.
+        size_t validLength = 0;
+        vector<WalRecord> noRecords;
+        for (auto segment = segments.rbegin(); segment != segments.rend() && lastLsn == 0; ++segment) {
+            WalSegmentIndex &index = this->segmentIndexes[SegmentNumber(*segment)];
+            size_t length = ReadSegment(*segment, UINT64_MAX, noRecords, SIZE_MAX, 0, &index);
+            if (segment == segments.rbegin()) {
+                validLength = length;
             }
-        }
-
-        this->currentSegmentNumber = maxSegment;
-        this->currentWalPath = this->GetSegmentPath(this->currentSegmentNumber);
-
-        // Skaitome visus WAL failus.
-        auto records = this->ReadAll();
-        if (!records.empty()) {
             // Priskiriame paskutinio įrašo LSN, kaip LSN
-            this->currentSequenceNumber = records.back().lsn;
+            lastLsn = index.lastLsn;
         }
 
-        if (fs::exists(this->currentWalPath)) {
-            // Nustatome dabartinio WAL dydį
-            this->currentSegmentSize = fs::file_size(this->currentWalPath);
+        if (fs::exists(currentWalPath)) {
+            // Nustatome dabartinio WAL dydį. Nebaigtas (crash metu) paskutinis įrašas bus uždengtas END žyme.
+            this->currentSegmentSize = validLength;
+
+            // Senas tekstinis segmentas tik skaitomas, nauji įrašai eina į naują binary segmentą.
+            if (validLength > 0 && IsTextSegment(currentWalPath)) {
+                segmentNumber++;
+                this->currentSegmentSize = 0;
+            }
         }
-    } else {
-        // Gauname dabartinio WAL direktoriją.
-        this->currentWalPath = this->GetSegmentPath(this->currentSegmentNumber);
     }
+    this->currentSegmentNumber = segmentNumber;
 
-    if (!this->OpenWAL()) {
+    // Atidarome (arba sukuriame su header'iu) dabartinį segmentą.
+    if (this->OpenSegmentFile(segmentNumber) < 0) {
         throw std::runtime_error("Failed to open Log file");
     }
+    this->currentSegmentSize = std::max(this->currentSegmentSize, WalFormat::SEGMENT_HEADER_SIZE);
+    // Nauji įrašai nebus po šiukšlėmis: loginis galas pažymimas END žyme (failas nekerpamas, jis iš anksto išskirtas).
+    if (!this->WriteEndMarkerIoLocked(this->currentSegmentSize)) {
+        throw std::runtime_error("Failed to write Log file end marker");
+    }
+
+    // Įrašai, kuriuos radome diske, jau yra durable.
+    this->ResetRingIoLocked(lastLsn);
+    this->appenderThread = std::thread(&WAL::AppenderLoop, this);
+}
+
+WAL::~WAL() {
+    // Appender'is prieš išeidamas įrašo visus žiede likusius įrašus.
+    this->stopping = true;
+    {
+        std::lock_guard<std::mutex> lock(this->walMutex);
+        this->recordsQueued.notify_all();
+    }
+    this->durableAdvanced.notify_all();
+    if (this->appenderThread.joinable()) {
+        this->appenderThread.join();
+    }
+
+    std::lock_guard<std::mutex> ioLock(this->ioMutex);
+    this->CloseSegmentFile();
 }
 
 fs::path WAL::GetSegmentPath(const uint64_t &segmentNum) const {
@@ -131,47 +195,441 @@ vector<fs::path> WAL::GetAllSegments() const {
 }
 
 /**
- * @brief Checks if a new WAL should be started/opened
+ * @brief Atidaro segmento failą rašymui (pwrite nuo currentSegmentSize). Jei segmento dar nėra, jis paruošiamas
+ * (PrepareSegmentFile). Kviečiama laikant ioMutex (arba konstruktoriuje).
+ * @return file descriptor arba -1
+*/
+int WAL::OpenSegmentFile(uint64_t segmentNumber) {
+    this->CloseSegmentFile();
+
+    fs::path segmentPath = this->GetSegmentPath(segmentNumber);
+    std::error_code errorCode;
+    uintmax_t fileSize = fs::file_size(segmentPath, errorCode);
+    if ((errorCode || fileSize < WalFormat::SEGMENT_HEADER_SIZE) && !this->PrepareSegmentFile(segmentPath)) {
+        return -1;
+    }
+
+    int fd = ::open(segmentPath.c_str(), O_WRONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    this->walFd = fd;
+    this->walFdSegment = segmentNumber;
+    return fd;
+}
+
+/**
+ * @brief Įrašo tuščią segmentą: header'į su END žyme, toliau nuliai iki fileSize (su fdatasync).
+ * Header'is rašomas pirmas, kad failas iškart būtų tuščias segmentas.
+*/
+bool WAL::WriteEmptySegment(int fd, size_t fileSize) const {
+    string header = SegmentHeaderWithEndMarker();
+    const string zeros(std::min(fileSize, GROUP_COMMIT_MAX_BYTES), '\0');
+    bool ok = PWriteAll(fd, header.data(), header.size(), 0);
+    for (size_t offset = header.size(); ok && offset < fileSize; offset += zeros.size()) {
+        ok = PWriteAll(fd, zeros.data(), std::min(zeros.size(), fileSize - offset), offset);
+    }
+    return ok && ::fdatasync(fd) == 0;
+}
+
+/**
+ * @brief Paruošia naują segmentą: paima perdirbtą (RecycleSegment) arba sukuria naują, iš anksto išskirtą iki
+ * maxSegmentSize ir vieną kartą užpildytą nuliais. Vėlesni rašymai nekeičia failo dydžio, todėl fdatasync nereikia
+ * sync'inti metaduomenų. Failas paruošiamas kitu vardu ir tik tada pervadinamas, kad crash'as nepaliktų pusiau
+ * paruošto segmento.
+*/
+bool WAL::PrepareSegmentFile(const fs::path &segmentPath) {
+    std::error_code errorCode;
+    fs::path prepared;
+    if (!this->TakeRecycledSegment(prepared)) {
+        prepared = this->walDirectory / (this->name + ".tmp");
+        int fd = ::open(prepared.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        // posix_fallocate gali būti nepalaikomas - tada užtenka užpildymo nuliais.
+        ::posix_fallocate(fd, 0, static_cast<off_t>(this->maxSegmentSize));
+        bool ok = this->WriteEmptySegment(fd, this->maxSegmentSize);
+        ::close(fd);
+        if (!ok) {
+            fs::remove(prepared, errorCode);
+            return false;
+        }
+    }
+
+    fs::rename(prepared, segmentPath, errorCode);
+    if (errorCode) {
+        return false;
+    }
+    // Naujas failas turi išlikti ir direktorijoje.
+    SyncDirectory(this->walDirectory);
+    return true;
+}
+
+/**
+ * @brief Paima vieną perdirbtą segmentą (<name>_<n>.free) iš rezervo.
+ * @return false, jei rezervas tuščias
+*/
+bool WAL::TakeRecycledSegment(fs::path &recycledPath) {
+    std::lock_guard<std::mutex> lock(this->recycleMutex);
+    std::error_code errorCode;
+    for (const auto &entry : fs::directory_iterator(this->walDirectory, errorCode)) {
+        if (entry.path().extension() == ".free") {
+            recycledPath = entry.path();
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Nebereikalingas segmentas perrašomas tuščiu segmentu (WriteEmptySegment) ir pervadinamas į rezervą, kad kitas
+ * segmentas nebūtų kuriamas appender'io kelyje. Rezervui pilnam (MAX_RECYCLED_SEGMENTS) segmentas ištrinamas.
+ * Seni įrašai užnulinami: jų CRC galioja, todėl po crash'o, kai naujo naudojimo END žymė dar ne diske, jie būtų
+ * perskaityti kaip paskutiniai segmento įrašai.
+*/
+void WAL::RecycleSegment(const fs::path &segmentPath) {
+    std::error_code errorCode;
+    size_t recycled = 0;
+    {
+        std::lock_guard<std::mutex> lock(this->recycleMutex);
+        for (const auto &entry : fs::directory_iterator(this->walDirectory, errorCode)) {
+            recycled += (entry.path().extension() == ".free") ? 1 : 0;
+        }
+    }
+    uintmax_t fileSize = fs::file_size(segmentPath, errorCode);
+    if (recycled >= MAX_RECYCLED_SEGMENTS || errorCode || fileSize < this->maxSegmentSize) {
+        fs::remove(segmentPath, errorCode);
+        return;
+    }
+
+    // Pildoma be recycleMutex, kad appender'is tuo metu galėtų paimti kitą rezervo segmentą.
+    int fd = ::open(segmentPath.c_str(), O_WRONLY);
+    // Paskutinė grupė gali būti išėjusi už maxSegmentSize, todėl nulinamas visas failas.
+    bool ok = fd >= 0 && this->WriteEmptySegment(fd, static_cast<size_t>(fileSize));
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    fs::path recycledPath = segmentPath;
+    recycledPath.replace_extension(".free");
+    if (ok) {
+        std::lock_guard<std::mutex> lock(this->recycleMutex);
+        fs::rename(segmentPath, recycledPath, errorCode);
+    }
+    if (!ok || errorCode) {
+        fs::remove(segmentPath, errorCode);
+    }
+}
+
+/**
+ * @brief Atjungtus segmentus (DeleteOldSegments) nulina ir perkelia į rezervą (RecycleSegment). Ilgas I/O, todėl
+ * kviečiama be tree lock'o; appender'is ir skaitytojai neblokuojami.
+*/
+void WAL::RecycleSegments() {
+    std::lock_guard<std::mutex> lock(this->detachedMutex);
+    vector<fs::path> detached;
+    std::error_code errorCode;
+    for (const auto &entry : fs::directory_iterator(this->walDirectory, errorCode)) {
+        if (entry.path().extension() == ".recycle") {
+            detached.push_back(entry.path());
+        }
+    }
+    for (const auto &segmentPath : detached) {
+        this->RecycleSegment(segmentPath);
+    }
+}
+
+/**
+ * @brief Įrašo END žymę ties offset ir sync'ina. Kviečiama laikant ioMutex (arba konstruktoriuje).
+*/
+bool WAL::WriteEndMarkerIoLocked(size_t offset) {
+    const char endMarker[WalFormat::END_MARKER_SIZE] = {};
+    return this->walFd >= 0 && PWriteAll(this->walFd, endMarker, sizeof(endMarker), offset) && ::fdatasync(this->walFd) == 0;
+}
+
+/**
+ * @brief Įrašo surinktą grupę ties offset, iškart po jos - END žymę (kitos grupės ją perrašys). Kviečiama laikant ioMutex.
+*/
+bool WAL::WriteBufferIoLocked(size_t offset) {
+    size_t dataSize = this->writeBuffer.size();
+    this->writeBuffer.append(WalFormat::END_MARKER_SIZE, '\0');
+    bool ok = PWriteAll(this->walFd, this->writeBuffer.data(), this->writeBuffer.size(), offset);
+    this->writeBuffer.resize(dataSize);
+    return ok;
+}
+
+/**
+ * @brief Uždaro dabartinį segmento failą (su fdatasync). Kviečiama laikant ioMutex.
+*/
+void WAL::CloseSegmentFile() {
+    if (this->walFd >= 0) {
+        ::fdatasync(this->walFd);
+        ::close(this->walFd);
+        this->walFd = -1;
+    }
+}
+
+/**
+ * @brief Rezervuoja LSN (arba paima iš įrašo, follower'iui), užkoduoja įrašą ir įdeda į žiedą.
+ * Lock-free: vienas atomic increment + slot'o publikavimas. Jei žiedas pilnas, laukia appender'io.
+ * Įrašai su nurodytu LSN (LogWithLSN) turi ateiti iš eilės (follower'is taiko juos po tree lock'u),
+ * LSN ne iš eilės perstato žiedą (Rebase).
+ * @return false, jei WAL rašymas jau buvo nepavykęs
+*/
+bool WAL::Append(WalRecord &record, bool assignLsn) {
+    if (this->ioFailed) {
+        return false;
+    }
+
+    if (assignLsn) {
+        record.lsn = this->reservedLsn.fetch_add(1) + 1;
+    } else {
+        if (record.lsn == 0) {
+            return false;
+        }
+        uint64_t expected = record.lsn - 1;
+        while (!this->reservedLsn.compare_exchange_strong(expected, record.lsn)) {
+            // LSN ne iš eilės (pvz. follower'iui praleista išvalyta WAL dalis).
+            this->Rebase(record.lsn - 1);
+            expected = record.lsn - 1;
+        }
+    }
+
+    // Užkoduojam prieš užimant slot'ą. Buferiai keičiami su slot'u, todėl jų talpa pernaudojama.
+    thread_local string encoded;
+    encoded.clear();
+    EncodeRecord(record, encoded);
+    size_t encodedSize = encoded.size();
+
+    WalRingSlot &slot = this->ring[record.lsn & (RING_CAPACITY - 1)];
+    while (slot.sequence.load(std::memory_order_acquire) != record.lsn) {
+        std::this_thread::yield();
+    }
+    slot.bytes.swap(encoded);
+    this->queuedBytes.fetch_add(encodedSize);
+    slot.sequence.store(record.lsn + 1);
+
+    // Appender'is žadinamas tik kai jis miega be įrašų arba grupė jau pasiekė dydžio ribą.
+    uint8_t state = this->appenderState.load();
+    if (state == APPENDER_IDLE || (state == APPENDER_GROUPING && this->queuedBytes.load() >= GROUP_COMMIT_MAX_BYTES)) {
+        this->NotifyAppender();
+    }
+    return true;
+}
+
+void WAL::NotifyAppender() {
+    std::lock_guard<std::mutex> lock(this->walMutex);
+    this->recordsQueued.notify_one();
+}
+
+bool WAL::RecordReady(uint64_t lsn) const {
+    return this->ring[lsn & (RING_CAPACITY - 1)].sequence.load() == lsn + 1;
+}
+
+/**
+ * @brief Appender thread'as: laukia įrašų žiede, surenka grupę ir ją įrašo.
 */
-bool WAL::ShouldRotate() const {
-    return this->currentSegmentSize >= this->maxSegmentSize;
+void WAL::AppenderLoop() {
+    while (this->WaitForRecords()) {
+        std::lock_guard<std::mutex> ioLock(this->ioMutex);
+        this->WriteQueuedIoLocked();
+    }
 }
 
 /**
- * @brief Rotates to a new WAL (Uždaro dabartinį WAL ir atidaro nauja WAL su +1 segmento numeriu)
- * @return true if rotation happened successfully.
+ * @brief Laukia pirmo įrašo, tada (GROUP - iki groupCommitDelay, INTERVAL - iki syncInterval) daugiau įrašų.
+ * @return false, kai WAL uždaromas ir žiedas tuščias
 */
-bool WAL::RotateWAL() {
-    if (this->walFile.is_open()) {
-        this->walFile.close();
+bool WAL::WaitForRecords() {
+    std::unique_lock<std::mutex> lock(this->walMutex);
+    this->appenderState = APPENDER_IDLE;
+    this->recordsQueued.wait(lock, [this] { return this->stopping || this->RecordReady(this->dequeueLsn); });
+    if (!this->RecordReady(this->dequeueLsn)) {
+        this->appenderState = APPENDER_RUNNING;
+        return false;
     }
 
-    this->currentSegmentNumber++;
-    this->currentWalPath = this->GetSegmentPath(this->currentSegmentNumber);
-    this->currentSegmentSize = 0;
+    WalSyncPolicy policy = this->syncPolicy;
+    if (!this->stopping && this->urgentFlushes == 0 && policy != WalSyncPolicy::PER_COMMIT) {
+        this->appenderState = APPENDER_GROUPING;
+        std::chrono::microseconds delay = (policy == WalSyncPolicy::GROUP)
+            ? this->groupCommitDelay
+            : std::chrono::duration_cast<std::chrono::microseconds>(this->syncInterval);
+        this->recordsQueued.wait_for(lock, delay, [this] {
+            return this->stopping || this->urgentFlushes > 0 || this->queuedBytes >= GROUP_COMMIT_MAX_BYTES;
+        });
+    }
+    this->appenderState = APPENDER_RUNNING;
+    return true;
+}
 
-    return this->OpenWAL();
+/**
+ * @brief Paima paruoštus įrašus iš žiedo LSN tvarka (iki GROUP_COMMIT_MAX_BYTES), pasuka segmentą, jei jis pilnas,
+ * įrašo vienu write + fdatasync ir paskelbia durableLsn. Kviečiama laikant ioMutex.
+*/
+void WAL::WriteQueuedIoLocked() {
+    this->writeBuffer.clear();
+    uint64_t lsn = this->dequeueLsn;
+    uint64_t lastLsn = 0;
+    size_t drainedBytes = 0;
+    bool written = !this->ioFailed && this->walFd >= 0;
+    size_t batchOffset = this->currentSegmentSize;
+
+    while (this->RecordReady(lsn) && this->writeBuffer.size() < GROUP_COMMIT_MAX_BYTES) {
+        // Segmentas pilnas - kas surinkta, įrašoma į jį, o nauji įrašai eina į kitą segmentą.
+        if (written && this->currentSegmentSize >= this->maxSegmentSize) {
+            written = this->WriteBufferIoLocked(batchOffset) && this->OpenSegmentFile(this->currentSegmentNumber + 1) >= 0;
+            if (written) {
+                this->currentSegmentNumber++;
+                this->currentSegmentSize = WalFormat::SEGMENT_HEADER_SIZE;
+            }
+            this->writeBuffer.clear();
+            batchOffset = this->currentSegmentSize;
+        }
+
+        WalRingSlot &slot = this->ring[lsn & (RING_CAPACITY - 1)];
+        {
+            std::lock_guard<std::mutex> indexLock(this->indexMutex);
+            this->segmentIndexes[this->currentSegmentNumber].Add(lsn, this->currentSegmentSize);
+        }
+        this->writeBuffer += slot.bytes;
+        this->currentSegmentSize += slot.bytes.size();
+        drainedBytes += slot.bytes.size();
+        // Slot'as laisvas kitam ratui.
+        slot.sequence.store(lsn + RING_CAPACITY, std::memory_order_release);
+        lastLsn = lsn;
+        lsn++;
+    }
+    this->dequeueLsn = lsn;
+    this->queuedBytes.fetch_sub(drainedBytes);
+    if (lastLsn == 0) {
+        return;
+    }
+
+    // Failas iš anksto išskirtas, todėl fdatasync sync'ina tik duomenis.
+    written = written && this->WriteBufferIoLocked(batchOffset) && ::fdatasync(this->walFd) == 0;
+    {
+        std::lock_guard<std::mutex> lock(this->walMutex);
+        if (written) {
+            this->durableLsn = lastLsn;
+        } else if (!this->ioFailed) {
+            this->ioFailed = true;
+            std::cerr << "CRITICAL: WAL write/fdatasync failed, WAL is no longer writable.\n";
+        }
+    }
+    this->durableAdvanced.notify_all();
 }
 
 /**
- *@brief Opens WAL.
- @return true if opened WAL successfully.
+ * @brief Žiedas tuščias ir paskutinis LSN yra lastLsn: kitas įrašas gaus lastLsn + 1.
+ * Kviečiama laikant ioMutex (arba konstruktoriuje), kai niekas nerašo į WAL.
 */
-bool WAL::OpenWAL() {
-    this->walFile.open(this->currentWalPath.string(), ios::in | ios::out | ios::binary | ios::app);
+void WAL::ResetRingIoLocked(uint64_t lastLsn) {
+    for (uint64_t lsn = lastLsn + 1; lsn <= lastLsn + RING_CAPACITY; lsn++) {
+        WalRingSlot &slot = this->ring[lsn & (RING_CAPACITY - 1)];
+        slot.bytes.clear();
+        slot.sequence = lsn;
+    }
+    this->reservedLsn = lastLsn;
+    this->dequeueLsn = lastLsn + 1;
+    this->queuedBytes = 0;
+    this->durableLsn = lastLsn;
+}
 
-    if (!this->walFile) {
-        this->walFile.clear();
-        this->walFile.open(this->currentWalPath.string(), ios::out | ios::binary);
-        this->walFile.close();
-        this->walFile.open(this->currentWalPath.string(), ios::in | ios::out | ios::binary | ios::app);
+/**
+ * @brief Tęsia LSN numeraciją nuo lastLsn + 1. Laukiantys įrašai pirma įrašomi.
+ * Kviečiama, kai kiti rašytojai neveikia (Database tai užtikrina tree lock'u).
+*/
+void WAL::Rebase(uint64_t lastLsn) {
+    this->Flush();
+    {
+        std::lock_guard<std::mutex> ioLock(this->ioMutex);
+        std::lock_guard<std::mutex> lock(this->walMutex);
+        this->ResetRingIoLocked(lastLsn);
     }
+    this->durableAdvanced.notify_all();
+}
 
-    return this->walFile.is_open();
+/**
+ * @brief Laukia, kol visi jau rezervuoti įrašai bus įrašyti (nepaisant group/interval delsimo).
+*/
+void WAL::Flush() {
+    uint64_t target = this->reservedLsn;
+    std::unique_lock<std::mutex> lock(this->walMutex);
+    if (this->durableLsn >= target || this->ioFailed) {
+        return;
+    }
+    uint64_t generation = this->resetGeneration;
+    this->urgentFlushes++;
+    this->recordsQueued.notify_one();
+    this->durableAdvanced.wait(lock, [&] {
+        return this->durableLsn >= target || this->ioFailed || this->resetGeneration != generation;
+    });
+    this->urgentFlushes--;
 }
 
-uint64_t WAL::GetNextSequenceNumber() {
-    return ++this->currentSequenceNumber;
+/**
+ * @brief Nustato, kada įrašai tampa durable.
+*/
+void WAL::SetSyncPolicy(WalSyncPolicy policy, std::chrono::microseconds groupDelay, std::chrono::milliseconds interval) {
+    std::lock_guard<std::mutex> lock(this->walMutex);
+    this->syncPolicy = policy;
+    this->groupCommitDelay = groupDelay;
+    this->syncInterval = interval;
+    this->recordsQueued.notify_one();
+}
+
+/**
+ * @brief Laukia, kol įrašas su nurodytu LSN bus durable. INTERVAL režime nelaukia.
+ * @return true, jei įrašas durable (arba WAL buvo reset'intas po jo)
+*/
+bool WAL::WaitDurable(uint64_t lsn) {
+    if (this->syncPolicy == WalSyncPolicy::INTERVAL) {
+        return !this->ioFailed;
+    }
+    std::unique_lock<std::mutex> lock(this->walMutex);
+    uint64_t generation = this->resetGeneration;
+    this->durableAdvanced.wait(lock, [&] {
+        return this->durableLsn >= lsn || this->ioFailed || this->resetGeneration != generation;
+    });
+    return this->durableLsn >= lsn || this->resetGeneration != generation;
+}
+
+uint64_t WAL::GetDurableLsn() const {
+    return this->durableLsn;
+}
+
+uint64_t WAL::GetCurrentSequenceNumber() const {
+    return this->reservedLsn;
+}
+
+uint64_t WAL::GetCurrentSegmentNumber() const {
+    return this->currentSegmentNumber;
+}
+
+/**
+ * @brief Seniausias WAL'e dar esantis LSN. Įrašų su mažesniu LSN iš WAL nebegalima gauti (ištrinti ar suspausti).
+ * @return pirmo įrašo LSN arba GetCurrentSequenceNumber() + 1, jei WAL tuščias
+*/
+uint64_t WAL::GetFirstLsn() {
+    // Dar neįrašyti įrašai nuleidžiami į failą, kitaip tuščias segmentas atrodytų kaip tuščias WAL.
+    this->Flush();
+    for (const auto &segmentPath : this->GetAllSegments()) {
+        uint64_t firstLsn = this->SegmentFirstLsn(segmentPath);
+        if (firstLsn != 0) {
+            return firstLsn;
+        }
+    }
+    return this->reservedLsn + 1;
+}
+
+/**
+ * @brief Tęsia LSN numeraciją bent nuo nurodyto (pvz. meta puslapio LSN, jei WAL galas buvo prarastas).
+*/
+void WAL::EnsureSequenceNumberAtLeast(uint64_t lsn) {
+    if (lsn > this->reservedLsn) {
+        this->Rebase(lsn);
+    }
 }
 
 /**
@@ -227,83 +685,312 @@ WalRecord WAL::ParseWalRecord(const string &line) {
     return record;
 }
 
-bool WAL::WriteRecordToStream(const WalRecord& record) {
-    auto startPos = this->walFile.tellp();
+/**
+ * @brief Appends binary record (header + key + value) to out.
+*/
+void WAL::EncodeRecord(const WalRecord &record, string &out) {
+    if (record.key.size() > UINT16_MAX || record.value.size() > UINT32_MAX) {
+        throw std::length_error("WAL record is too big");
+    }
+    auto keyLength = static_cast<uint16_t>(record.key.size());
+    auto valueLength = static_cast<uint32_t>(record.value.size());
+    auto operation = static_cast<uint8_t>(record.operation);
+
+    size_t start = out.size();
+    out.resize(start + WalFormat::RECORD_HEADER_SIZE);
+    char *header = out.data() + start;
+    memcpy(header + 4, &record.lsn, sizeof(record.lsn));
+    memcpy(header + 12, &operation, sizeof(operation));
+    memcpy(header + 13, &keyLength, sizeof(keyLength));
+    memcpy(header + 15, &valueLength, sizeof(valueLength));
+    out.append(record.key);
+    out.append(record.value);
+
+    uint32_t crc = Crc32c(out.data() + start + 4, out.size() - start - 4);
+    memcpy(out.data() + start, &crc, sizeof(crc));
+}
 
-    this->walFile << record.lsn << "|";
-    if (record.operation == WalOperation::SET) {
-        this->walFile << "SET|" << record.key << "|" << EscapeValue(record.value) << "\n";
-    } else {
-        this->walFile << "DELETE|" << record.key << "\n";
+/**
+ * @brief Decodes one binary record starting at offset. On success offset is moved past it.
+ * @return INCOMPLETE if data ends in the middle of the record, CORRUPT if checksum does not match.
+*/
+WalDecodeStatus WAL::DecodeRecord(const char *data, size_t size, size_t &offset, WalRecord &record) {
+    if (size - offset < WalFormat::RECORD_HEADER_SIZE) {
+        return WalDecodeStatus::INCOMPLETE;
+    }
+    const char *header = data + offset;
+    uint32_t crc = 0;
+    uint64_t lsn = 0;
+    uint8_t operation = 0;
+    uint16_t keyLength = 0;
+    uint32_t valueLength = 0;
+    memcpy(&crc, header, sizeof(crc));
+    memcpy(&lsn, header + 4, sizeof(lsn));
+    memcpy(&operation, header + 12, sizeof(operation));
+    memcpy(&keyLength, header + 13, sizeof(keyLength));
+    memcpy(&valueLength, header + 15, sizeof(valueLength));
+
+    size_t recordLength = WalFormat::RECORD_HEADER_SIZE + keyLength + valueLength;
+    if (size - offset < recordLength) {
+        return WalDecodeStatus::INCOMPLETE;
+    }
+    if (Crc32c(header + 4, recordLength - 4) != crc || lsn == 0 ||
+        operation > static_cast<uint8_t>(WalOperation::DELETE)) {
+        return WalDecodeStatus::CORRUPT;
     }
-    this->walFile.flush();
 
-    auto endPos = this->walFile.tellp();
-    this->currentSegmentSize += (endPos - startPos);
-    return !this->walFile.fail();
+    record.lsn = lsn;
+    record.operation = static_cast<WalOperation>(operation);
+    record.key.assign(header + WalFormat::RECORD_HEADER_SIZE, keyLength);
+    record.value.assign(header + WalFormat::RECORD_HEADER_SIZE + keyLength, valueLength);
+    offset += recordLength;
+    return WalDecodeStatus::OK;
 }
 
 /**
- * @brief Logs SET operation to WAL.
- * @param key raktas
- * @param value reikšmė
- * @return true if SET operation was logged successfully.
+ * @brief Patikrina ar segmentas yra senas tekstinis (neprasideda MAGIC).
 */
-bool WAL::LogSet(const string &key, const string &value) {
-    if (!this->walFile.is_open()) {
-        return false;
-    }
+bool WAL::IsTextSegment(const fs::path &segmentPath) {
+    ifstream logFile(segmentPath.string(), ios::in | ios::binary);
+    char magic[sizeof(WalFormat::MAGIC)] = {};
+    logFile.read(magic, sizeof(magic));
+    return logFile.gcount() > 0 && memcmp(magic, WalFormat::MAGIC, static_cast<size_t>(logFile.gcount())) != 0;
+}
 
-    // Prieš log'inimą patikriname ar nereikia rotuoti į naują WAL.
-    if (this->ShouldRotate()) {
-        if (!this->RotateWAL()) {
+/**
+ * @brief Nuskaito segmento įrašus, kurių LSN > afterLsn. Binary segmentas skaitomas po READ_BUFFER_SIZE ir
+ * sustoja ties pirmu nebaigtu ar sugadintu įrašu (torn tail), END žyme arba įrašu, kurio LSN nedidesnis už
+ * ankstesnio (ne šio naudojimo likutis), todėl iš anksto išskirto segmento nuliai po loginiu galu neskaitomi.
+ * @param maxBytes kiek daugiausiai baitų skaityti nuo startOffset
+ * @return validžių baitų skaičius nuo segmento pradžios
+*/
+size_t WAL::ReadSegment(const fs::path &segmentPath, uint64_t afterLsn, vector<WalRecord> &records, size_t maxBytes,
+                        size_t startOffset, WalSegmentIndex *index) {
+    ifstream logFile(segmentPath.string(), ios::in | ios::binary);
+    if (!logFile) {
+        return 0;
+    }
+    // startOffset > 0 - iš indekso žinomo įrašo pradžios (binary segmentas, header'is jau patikrintas).
+    logFile.seekg(static_cast<std::streamoff>(startOffset));
+
+    string data;
+    size_t dataOffset = startOffset; // data[0] vieta segmente
+    size_t remaining = maxBytes;
+    auto readMore = [&logFile, &data, &remaining]() {
+        size_t chunk = std::min(WalReader::READ_BUFFER_SIZE, remaining);
+        if (chunk == 0 || !logFile) {
             return false;
         }
+        size_t oldSize = data.size();
+        data.resize(oldSize + chunk);
+        logFile.read(data.data() + oldSize, static_cast<std::streamsize>(chunk));
+        auto got = static_cast<size_t>(logFile.gcount());
+        data.resize(oldSize + got);
+        remaining -= got;
+        return got > 0;
+    };
+    if (!readMore()) {
+        return startOffset;
     }
 
-    WalRecord record(this->GetNextSequenceNumber(), WalOperation::SET, key, value);
+    // Senas tekstinis formatas (migracijai), skaitomas visas (nepaisant maxBytes, kad eilutė nebūtų nukirpta).
+    if (startOffset == 0 &&
+        memcmp(data.data(), WalFormat::MAGIC, std::min(data.size(), sizeof(WalFormat::MAGIC))) != 0) {
+        remaining = SIZE_MAX;
+        while (readMore()) {
+        }
+        istringstream lines(data);
+        string line;
+        while (getline(lines, line)) {
+            auto record = ParseWalRecord(line);
+            if (record.lsn == 0) {
+                continue;
+            }
+            if (index != nullptr) {
+                index->textFormat = true;
+                index->firstLsn = (index->firstLsn == 0) ? record.lsn : index->firstLsn;
+                index->lastLsn = record.lsn;
+            }
+            if (record.lsn > afterLsn) {
+                records.push_back(record);
+            }
+        }
+        return data.size();
+    }
 
-    return this->WriteRecordToStream(record);
+    size_t offset = 0;
+    if (startOffset == 0) {
+        if (data.size() < WalFormat::SEGMENT_HEADER_SIZE) {
+            return 0;
+        }
+        uint32_t version = 0;
+        memcpy(&version, data.data() + sizeof(WalFormat::MAGIC), sizeof(version));
+        if (version != WalFormat::VERSION) {
+            throw std::runtime_error("Unsupported WAL segment version in " + segmentPath.string());
+        }
+        offset = WalFormat::SEGMENT_HEADER_SIZE;
+    }
+
+    WalRecord record;
+    uint64_t previousLsn = 0;
+    while (true) {
+        size_t recordOffset = offset;
+        WalDecodeStatus status = DecodeRecord(data.data(), data.size(), offset, record);
+        if (status == WalDecodeStatus::INCOMPLETE) {
+            // Įrašas kerta skaitymo ribą: išmetam jau dekoduotą dalį ir skaitom toliau.
+            data.erase(0, offset);
+            dataOffset += offset;
+            offset = 0;
+            if (readMore()) {
+                continue;
+            }
+            break;
+        }
+        if (status != WalDecodeStatus::OK || record.lsn <= previousLsn) {
+            offset = recordOffset;
+            break; // END žymė, sugadintas įrašas arba senas įrašas
+        }
+        previousLsn = record.lsn;
+        if (index != nullptr) {
+            index->Add(record.lsn, dataOffset + recordOffset);
+        }
+        if (record.lsn > afterLsn) {
+            records.push_back(std::move(record));
+        }
+    }
+    return dataOffset + offset;
 }
 
 /**
- * @brief Logs DELETE operation to WAL.
- * @param key raktas
- * @return true if DELETE operation was logged successfully.
+ * @brief Prideda įrašą į indeksą: first/last LSN visada, offset'ą - jei nuo paskutinio taško praėjo INDEX_INTERVAL_BYTES.
 */
-bool WAL::LogDelete(const string &key) {
-    if (!this->walFile.is_open()) {
-        return false;
+void WalSegmentIndex::Add(uint64_t lsn, size_t offset) {
+    if (this->firstLsn == 0) {
+        this->firstLsn = lsn;
+    }
+    this->lastLsn = lsn;
+    if (this->offsets.empty() || offset - this->offsets.back().second >= INDEX_INTERVAL_BYTES) {
+        this->offsets.emplace_back(lsn, offset);
     }
+}
 
-    // Prieš log'inimą patikriname ar nereikia rotuoti į naują WAL.
-    if (this->ShouldRotate()) {
-        if (!this->RotateWAL()) {
-            return false;
+/**
+ * @brief Iš kurios vietos skaityti segmentą, kad gautume įrašus su LSN > afterLsn.
+ * Dar neindeksuotas (po WAL atidarymo neskaitytas) segmentas čia nuskaitomas ir indeksuojamas vieną kartą.
+ * @param startOffset paskutinis indekso taškas, kurio LSN <= afterLsn + 1 (0 - skaityti visą segmentą)
+ * @return false, jei visi segmento įrašai <= afterLsn (segmento skaityti nereikia)
+*/
+bool WAL::FindReadOffset(const fs::path &segmentPath, uint64_t afterLsn, size_t &startOffset) {
+    startOffset = 0;
+    uint64_t segmentNumber = SegmentNumber(segmentPath);
+    std::unique_lock<std::mutex> lock(this->indexMutex);
+    auto found = this->segmentIndexes.find(segmentNumber);
+    if (found == this->segmentIndexes.end() || found->second.firstLsnOnly) {
+        lock.unlock();
+        WalSegmentIndex scanned;
+        vector<WalRecord> noRecords;
+        ReadSegment(segmentPath, UINT64_MAX, noRecords, SIZE_MAX, 0, &scanned);
+        lock.lock();
+        found = this->segmentIndexes.find(segmentNumber);
+        if (found == this->segmentIndexes.end() || found->second.firstLsnOnly) {
+            found = this->segmentIndexes.insert_or_assign(segmentNumber, std::move(scanned)).first;
         }
     }
 
-    WalRecord record(this->GetNextSequenceNumber(), WalOperation::DELETE, key);
+    const WalSegmentIndex &index = found->second;
+    if (index.firstLsn == 0) {
+        return true;
+    }
+    if (index.lastLsn <= afterLsn) {
+        return false;
+    }
+    if (index.textFormat) {
+        return true;
+    }
 
-    return this->WriteRecordToStream(record);
+    auto position = std::upper_bound(index.offsets.begin(), index.offsets.end(), afterLsn + 1,
+        [](uint64_t lsn, const std::pair<uint64_t, size_t> &entry) { return lsn < entry.first; });
+    if (position != index.offsets.begin()) {
+        startOffset = std::prev(position)->second;
+    }
+    return true;
 }
 
-bool WAL::LogWithLSN(WalRecord &walRecord) {
-    if (!this->walFile.is_open()) {
-        return false;
+/**
+ * @brief Pirmas segmento LSN iš indekso. Neindeksuoto segmento pradžia nuskaitoma ir LSN įsimenamas.
+ * @return LSN arba 0, jei segmentas tuščias
+*/
+uint64_t WAL::SegmentFirstLsn(const fs::path &segmentPath) {
+    uint64_t segmentNumber = SegmentNumber(segmentPath);
+    {
+        std::lock_guard<std::mutex> lock(this->indexMutex);
+        auto found = this->segmentIndexes.find(segmentNumber);
+        if (found != this->segmentIndexes.end() && found->second.firstLsn != 0) {
+            return found->second.firstLsn;
+        }
     }
 
-    if (this->ShouldRotate()) {
-        if (!this->RotateWAL()) {
-            return false;
+    uint64_t firstLsn = ReadFirstLsn(segmentPath);
+    if (firstLsn != 0) {
+        std::lock_guard<std::mutex> lock(this->indexMutex);
+        WalSegmentIndex &index = this->segmentIndexes[segmentNumber];
+        if (index.firstLsn == 0) {
+            index.firstLsn = firstLsn;
+            index.firstLsnOnly = true;
         }
     }
+    return firstLsn;
+}
 
-    // Update internal sequence number to track the highest seen LSN
-    this->currentSequenceNumber = std::max(walRecord.lsn, this->currentSequenceNumber);
+/**
+ * @brief Indekso taškai po startOffset, dalijantys segmentą į maždaug DECODE_CHUNK_BYTES dalis (lygiagrečiam dekodavimui).
+ * Imami tik durable įrašų taškai (appender'is indeksuoja įrašą prieš jį įrašydamas), likusi dalis - segmento galas.
+ * Tekstinis ar neindeksuotas segmentas nedalijamas.
+*/
+vector<size_t> WAL::ChunkOffsets(const fs::path &segmentPath, size_t startOffset) {
+    vector<size_t> chunkOffsets;
+    uint64_t durable = this->durableLsn.load();
+    std::lock_guard<std::mutex> lock(this->indexMutex);
+    auto found = this->segmentIndexes.find(SegmentNumber(segmentPath));
+    if (found == this->segmentIndexes.end() || found->second.textFormat) {
+        return chunkOffsets;
+    }
+    size_t chunkStart = startOffset;
+    for (const auto &entry : found->second.offsets) {
+        if (entry.first > durable) {
+            break;
+        }
+        if (entry.second >= chunkStart + WalReader::DECODE_CHUNK_BYTES) {
+            chunkOffsets.push_back(entry.second);
+            chunkStart = entry.second;
+        }
+    }
+    return chunkOffsets;
+}
 
-    WalRecord record(walRecord.lsn, walRecord.operation, walRecord.key, walRecord.value);
-    return WriteRecordToStream(record);
+/**
+ * @brief Logs SET operation to WAL.
+ * @param key raktas
+ * @param value reikšmė
+ * @return true if SET operation was logged successfully (durable only after WaitDurable).
+*/
+bool WAL::LogSet(const string &key, const string &value) {
+    WalRecord record(0, WalOperation::SET, key, value);
+    return this->Append(record, true);
+}
+
+/**
+ * @brief Logs DELETE operation to WAL.
+ * @param key raktas
+ * @return true if DELETE operation was logged successfully (durable only after WaitDurable).
+*/
+bool WAL::LogDelete(const string &key) {
+    WalRecord record(0, WalOperation::DELETE, key);
+    return this->Append(record, true);
+}
+
+bool WAL::LogWithLSN(WalRecord &walRecord) {
+    return this->Append(walRecord, false);
 }
 
 /**
@@ -311,76 +998,272 @@ bool WAL::LogWithLSN(WalRecord &walRecord) {
  @return vector of WalRecord. Literally every record of every WAL.
 */
 vector<WalRecord> WAL::ReadAll() {
-    vector<WalRecord> records;
-    auto segments = this->GetAllSegments();
+    return this->ReadFrom(0);
+}
 
+/**
+ * @brief Nuskaito visus įrašus, kurių LSN didesnis už nurodytą. Dideliems kiekiams naudoti OpenReader.
+ * @param lsn LSN riba
+ * @return įrašų, kurių LSN > nurodyto LSN, vektorius
+*/
+vector<WalRecord> WAL::ReadFrom(const uint64_t &lsn) {
+    vector<WalRecord> records;
+    WalReader reader = this->OpenReader(lsn);
+    WalRecord record;
+    while (reader.Next(record)) {
+        records.push_back(std::move(record));
+    }
+    return records;
+}
 
-    // Iteruojame per visus segmentus.
-    for (const auto &segmentPath : segments) {
-        if (!fs::exists(segmentPath)) {
-            continue;
+/**
+ * @brief Sukuria skaitytuvą įrašams, kurių LSN > afterLsn.
+ * @param parallelSegments kiek segmentų dalių (iki DECODE_CHUNK_BYTES) iš anksto dekoduoti lygiagrečiai
+ * (1 - nuosekliai, po vieną įrašą)
+ * Dar neįrašyti įrašai nuleidžiami į failą, kad skaitytojas (pvz. catch-up) jų nepraleistų.
+ * Segmentai su visais LSN <= afterLsn praleidžiami, pirmame reikalingame peršokama prie artimiausio indekso taško.
+*/
+WalReader WAL::OpenReader(uint64_t afterLsn, size_t parallelSegments) {
+    this->Flush();
+
+    vector<WalReaderSegment> segments;
+    // Offset'as ir failo identitetas paimami kartu, kol suspaudimas negali pakeisti segmento failo.
+    std::shared_lock<std::shared_mutex> filesLock(this->segmentFilesMutex);
+    auto segmentsOnDisk = this->GetAllSegments();
+    for (size_t i = 0; i < segmentsOnDisk.size(); i++) {
+        // Kito segmento pirmas LSN <= afterLsn + 1 - visi šio segmento įrašai <= afterLsn (segmento neskaitome).
+        if (i + 1 < segmentsOnDisk.size()) {
+            uint64_t nextFirstLsn = this->SegmentFirstLsn(segmentsOnDisk[i + 1]);
+            if (nextFirstLsn != 0 && nextFirstLsn <= afterLsn + 1) {
+                continue;
+            }
         }
-
-        ifstream logFile(segmentPath.string(), ios::in);
-        if (!logFile) {
-            continue;
+        size_t startOffset = 0;
+        if (this->FindReadOffset(segmentsOnDisk[i], afterLsn, startOffset)) {
+            WalReaderSegment segment{segmentsOnDisk[i], startOffset, FileId(segmentsOnDisk[i]), {}};
+            if (parallelSegments > 1) {
+                segment.chunkOffsets = this->ChunkOffsets(segmentsOnDisk[i], startOffset);
+            }
+            segments.push_back(std::move(segment));
         }
+    }
+    return WalReader(std::move(segments), &this->segmentFilesMutex, afterLsn, parallelSegments);
+}
 
-        // Skaitome kiekvien1 eilutę ir nuskaitomę įrašą.
-        string line;
-        while(getline(logFile, line)) {
-            auto record = ParseWalRecord(line);
-            if (record.lsn != 0) {
-                records.push_back(record);
+/**
+ * @brief Patikrina ar yra laukiančių įrašų WAL
+ * @return true, jei yra bent vienas įrašas
+*/
+bool WAL::HasPendingRecords() {
+    WalRecord record;
+    return this->OpenReader(0).Next(record);
+}
+
+WalReader::WalReader(vector<WalReaderSegment> segments, std::shared_mutex *segmentFilesMutex, uint64_t afterLsn,
+                     size_t parallelSegments)
+    : segments(std::move(segments)), segmentFilesMutex(segmentFilesMutex), afterLsn(afterLsn),
+      parallelSegments(std::min(std::max<size_t>(parallelSegments, 1), MAX_PARALLEL_SEGMENTS)) {}
+
+/**
+ * @brief Lygiagrečiai dekoduojamų segmentų skaičius pagal branduolių skaičių (iki MAX_PARALLEL_SEGMENTS).
+*/
+size_t WalReader::DefaultParallelism() {
+    return std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1U), MAX_PARALLEL_SEGMENTS);
+}
+
+/**
+ * @brief Lygiagretus režimas: grąžina kitą įrašą iš jau dekoduotos dalies; kai ji baigiasi, paima kitą
+ * (laukia jos dekodavimo) ir iškart pradeda dekoduoti kitas, kad langas liktų pilnas.
+*/
+bool WalReader::NextDecoded(WalRecord &record) {
+    while (true) {
+        while (this->decodedPosition >= this->decodedRecords.size()) {
+            this->StartDecoding();
+            if (this->decodingChunks.empty()) {
+                return false;
+            }
+            WalDecodedChunk chunk = this->decodingChunks.front().get();
+            this->decodingChunks.pop_front();
+            if (chunk.continueReading) {
+                // Segmento galas (ir po OpenReader įrašyti įrašai) skaitomas toliau, prieš kitų segmentų dalis.
+                this->decodingChunks.push_front(this->DecodeChunk(chunk.next.path, chunk.next.fileId, chunk.next.startOffset,
+                                                                  DECODE_CHUNK_BYTES, true));
             }
+            this->decodedRecords = std::move(chunk.records);
+            this->decodedPosition = 0;
+            this->StartDecoding();
+        }
+        record = std::move(this->decodedRecords[this->decodedPosition++]);
+        if (record.lsn > this->afterLsn) {
+            this->afterLsn = record.lsn;
+            return true;
         }
+    }
+}
 
-        logFile.close();
+/**
+ * @brief Paleidžia segmentų dalių dekodavimą worker thread'uose, kol dekoduojamų yra parallelSegments.
+ * Dalys tarp chunkOffsets turi žinomą ilgį, paskutinė (segmento galas) skaitoma po DECODE_CHUNK_BYTES iki END žymės.
+*/
+void WalReader::StartDecoding() {
+    while (this->decodingChunks.size() < this->parallelSegments && this->nextSegment < this->segments.size()) {
+        const WalReaderSegment &segment = this->segments[this->nextSegment];
+        size_t chunk = this->nextChunk;
+        bool tail = (chunk == segment.chunkOffsets.size());
+        size_t startOffset = (chunk == 0) ? segment.startOffset : segment.chunkOffsets[chunk - 1];
+        size_t maxBytes = tail ? DECODE_CHUNK_BYTES : segment.chunkOffsets[chunk] - startOffset;
+        this->decodingChunks.push_back(this->DecodeChunk(segment.path, segment.fileId, startOffset, maxBytes, tail));
+        if (tail) {
+            this->nextSegment++;
+            this->nextChunk = 0;
+        } else {
+            this->nextChunk++;
+        }
     }
+}
 
-    return records;
+/**
+ * @brief Dekoduoja vieną segmento dalį worker thread'e: įrašus su LSN > afterLsn iš [startOffset, startOffset + maxBytes).
+ * Jei suspaudimas pakeitė failą, offset'ai nebegalioja: naujas failas skaitomas nuo pradžios kaip segmento galas
+ * (jau grąžinti įrašai praleidžiami pagal LSN).
+*/
+std::future<WalDecodedChunk> WalReader::DecodeChunk(const fs::path &segmentPath, uint64_t fileId, size_t startOffset,
+                                                    size_t maxBytes, bool tail) const {
+    uint64_t minLsn = this->afterLsn;
+    std::shared_mutex *filesMutex = this->segmentFilesMutex;
+    return std::async(std::launch::async, [segmentPath, fileId, startOffset, maxBytes, tail, minLsn, filesMutex] {
+        WalDecodedChunk chunk;
+        std::shared_lock<std::shared_mutex> filesLock(*filesMutex);
+        chunk.next.path = segmentPath;
+        chunk.next.fileId = FileId(segmentPath);
+        size_t readFrom = startOffset;
+        size_t readBytes = maxBytes;
+        bool readToEnd = tail;
+        if (chunk.next.fileId != fileId) {
+            readFrom = 0;
+            readBytes = DECODE_CHUNK_BYTES;
+            readToEnd = true;
+        }
+        chunk.next.startOffset = WAL::ReadSegment(segmentPath, minLsn, chunk.records, readBytes, readFrom);
+        chunk.continueReading = readToEnd && chunk.next.startOffset > readFrom;
+        return chunk;
+    });
 }
 
 /**
- * @brief Nuskaito visus įrašus, kurių LSN didesnis už nurodytą
- * @param lsn LSN riba
- * @return įrašų, kurių LSN > nurodyto LSN, vektorius
+ * @brief Grąžina kitą įrašą su LSN > afterLsn.
+ * Segmento skaitymas baigiasi ties pirmu nebaigtu ar sugadintu įrašu (kaip ReadSegment).
+ * @return false, kai įrašų nebeliko
 */
-vector<WalRecord> WAL::ReadFrom(const uint64_t &lsn) {
-    vector<WalRecord> records;
-    auto segments = this->GetAllSegments();
+bool WalReader::Next(WalRecord &record) {
+    if (this->parallelSegments > 1) {
+        return this->NextDecoded(record);
+    }
+    while (true) {
+        if (!this->segmentFile.is_open() && !this->OpenNextSegment()) {
+            return false;
+        }
 
-    for (const auto &segmentPath : segments) {
-        if (!fs::exists(segmentPath)) {
+        if (this->textSegment) {
+            string line;
+            if (!getline(this->segmentFile, line)) {
+                this->segmentFile.close();
+                continue;
+            }
+            record = WAL::ParseWalRecord(line);
+            if (record.lsn != 0 && record.lsn > this->afterLsn) {
+                this->afterLsn = record.lsn;
+                return true;
+            }
             continue;
         }
 
-        ifstream logFile(segmentPath.string(), ios::in);
-        if (!logFile) {
+        WalDecodeStatus status = WAL::DecodeRecord(this->buffer.data(), this->buffer.size(), this->bufferPosition, record);
+        if (status == WalDecodeStatus::OK && record.lsn > this->segmentLastLsn) {
+            this->segmentLastLsn = record.lsn;
+            if (record.lsn > this->afterLsn) {
+                this->afterLsn = record.lsn;
+                return true;
+            }
+            continue;
+        }
+        if (status == WalDecodeStatus::INCOMPLETE && this->FillBuffer()) {
             continue;
         }
+        this->segmentFile.close();
+    }
+}
 
-        string line;
-        while(getline(logFile, line)) {
-            auto record = ParseWalRecord(line);
-            // Pridedame tik validžius įrašus ir tuos kurių LSN yra didesnis už nurodytą parametruose.
-            if (record.lsn != 0 && record.lsn > lsn) {
-                records.push_back(record);
+/**
+ * @brief Atidaro kitą segmentą: patikrina header'į (arba nustato, kad tai senas tekstinis) ir nušoka į pradžios offset'ą.
+ * @return false, kai segmentų nebeliko
+*/
+bool WalReader::OpenNextSegment() {
+    while (this->nextSegment < this->segments.size()) {
+        const WalReaderSegment &segment = this->segments[this->nextSegment++];
+        const fs::path &segmentPath = segment.path;
+        size_t startOffset = segment.startOffset;
+        {
+            std::shared_lock<std::shared_mutex> filesLock(*this->segmentFilesMutex);
+            if (FileId(segmentPath) != segment.fileId) {
+                startOffset = 0;
             }
+            this->segmentFile.clear();
+            this->segmentFile.open(segmentPath, ios::in | ios::binary);
+        }
+        if (!this->segmentFile) {
+            // Segmentas ištrintas (ClearUpTo) po OpenReader.
+            continue;
+        }
+        this->buffer.clear();
+        this->bufferPosition = 0;
+        this->textSegment = false;
+        this->segmentLastLsn = 0;
+
+        if (startOffset > 0) {
+            this->segmentFile.seekg(static_cast<std::streamoff>(startOffset));
+            return true;
         }
 
-        logFile.close();
+        if (!this->FillBuffer()) {
+            this->segmentFile.close();
+            continue;
+        }
+        // Senas tekstinis formatas (migracijai) - skaitomas eilutėmis nuo pradžios.
+        if (memcmp(this->buffer.data(), WalFormat::MAGIC, std::min(this->buffer.size(), sizeof(WalFormat::MAGIC))) != 0) {
+            this->textSegment = true;
+            this->segmentFile.clear();
+            this->segmentFile.seekg(0);
+            return true;
+        }
+        if (this->buffer.size() < WalFormat::SEGMENT_HEADER_SIZE) {
+            this->segmentFile.close();
+            continue;
+        }
+        uint32_t version = 0;
+        memcpy(&version, this->buffer.data() + sizeof(WalFormat::MAGIC), sizeof(version));
+        if (version != WalFormat::VERSION) {
+            throw std::runtime_error("Unsupported WAL segment version in " + segmentPath.string());
+        }
+        this->bufferPosition = WalFormat::SEGMENT_HEADER_SIZE;
+        return true;
     }
-
-    return records;
+    return false;
 }
 
 /**
- * @brief Patikrina ar yra laukiančių įrašų WAL
- * @return true, jei yra bent vienas įrašas
+ * @brief Išmeta jau perskaitytą buferio dalį ir prideda iki READ_BUFFER_SIZE baitų iš failo.
+ * @return false, jei failo galas
 */
-bool WAL::HasPendingRecords() {
-    return !this->ReadAll().empty();
+bool WalReader::FillBuffer() {
+    this->buffer.erase(0, this->bufferPosition);
+    this->bufferPosition = 0;
+    size_t oldSize = this->buffer.size();
+    this->buffer.resize(oldSize + READ_BUFFER_SIZE);
+    this->segmentFile.read(this->buffer.data() + oldSize, static_cast<std::streamsize>(READ_BUFFER_SIZE));
+    size_t readBytes = static_cast<size_t>(this->segmentFile.gcount());
+    this->buffer.resize(oldSize + readBytes);
+    return readBytes > 0;
 }
 
 /**
@@ -388,105 +1271,199 @@ bool WAL::HasPendingRecords() {
  * @return true, jei valymas buvo sėkmingas
 */
 bool WAL::ClearAll() {
-    // Uždarome dabartinį failą, jeigu jis yra atidarytas.
-    if (this->walFile.is_open()) {
-        this->walFile.close();
-    }
+    // Laukiantys įrašai įrašomi, kad jų laukiantys rašytojai nepakibtų.
+    this->Flush();
+    std::lock_guard<std::mutex> maintenanceLock(this->segmentMaintenanceMutex);
+    std::lock_guard<std::mutex> ioLock(this->ioMutex);
+    this->compactedBeforeSegment = 0;
+    this->CloseSegmentFile();
 
     try {
-        // Ištriname visus segmentų failus.
+        // Ištriname visus segmentų failus ir perdirbtų segmentų rezervą (juose senesnės numeracijos įrašai).
         auto segments = this->GetAllSegments();
         for (const auto &segment : segments) {
             fs::remove(segment);
         }
-
-        // Atstatome pradinius parametrus.
-        this->currentSequenceNumber = 0;
-        this->currentSegmentNumber = 0;
-        this->currentSegmentSize = 0;
-        this->currentWalPath = this->GetSegmentPath(currentSegmentNumber);
-
-        return this->OpenWAL();
+        std::lock_guard<std::mutex> recycleLock(this->recycleMutex);
+        for (const auto &entry : fs::directory_iterator(this->walDirectory)) {
+            if (entry.path().extension() == ".free" || entry.path().extension() == ".recycle") {
+                fs::remove(entry.path());
+            }
+        }
     } catch (const std::exception &e) {
         return false;
     }
+
+    // Atstatome pradinius parametrus.
+    {
+        std::lock_guard<std::mutex> lock(this->walMutex);
+        this->currentSegmentNumber = 0;
+        this->currentSegmentSize = WalFormat::SEGMENT_HEADER_SIZE;
+        this->ResetRingIoLocked(0);
+        this->resetGeneration++;
+    }
+    {
+        std::lock_guard<std::mutex> indexLock(this->indexMutex);
+        this->segmentIndexes.clear();
+    }
+    this->durableAdvanced.notify_all();
+
+    return this->OpenSegmentFile(0) >= 0;
 }
 
 /**
- * @brief Išvalo WAL įrašus iki nurodyto LSN ir perkuria WAL su likusiais įrašais
- * @param lsn LSN riba
+ * @brief Ištrina uždarytus segmentus, kurių visi įrašai turi LSN <= nurodyto.
+ * Dabartinis segmentas neliečiamas ir įrašai neperrašomi, todėl rašymas į WAL neblokuojamas.
+ * @param lsn LSN riba (checkpoint / lėčiausio follower'io ACK)
  * @return true, jei valymas buvo sėkmingas
 */
 bool WAL::ClearUpTo(const uint64_t &lsn) {
-    auto segments = GetAllSegments();
-    vector<WalRecord> recordsToKeep;
+    auto segments = this->GetAllSegments();
 
-    // Surenkame visus įrašus, kurių LSN didesnis už nurodytą
-    for (const auto &segmentPath : segments) {
-        if (!fs::exists(segmentPath)) {
-            continue;
+    // Segmentą i galima trinti, jei segmento i+1 pirmas LSN <= lsn + 1 (visi segmento i įrašai <= lsn).
+    uint64_t deleteBefore = 0;
+    for (size_t i = 0; i + 1 < segments.size(); i++) {
+        uint64_t nextFirstLsn = this->SegmentFirstLsn(segments[i + 1]);
+        if (nextFirstLsn == 0 || nextFirstLsn > lsn + 1) {
+            break;
         }
+        deleteBefore = SegmentNumber(segments[i + 1]);
+    }
+
+    if (deleteBefore == 0) {
+        return true;
+    }
+    return this->DeleteOldSegments(deleteBefore);
+}
 
-        ifstream logFile(segmentPath.string(), ios::in);
-        if (!logFile) {
+/**
+ * @brief Suspaudžia iki maxSegments uždarytų, dar nesuspaustų segmentų: kiekvienam raktui paliekamas tik paskutinis
+ * SET/DELETE šiame intervale. Rezultatas įrašomas paskutinio intervalo segmento vietoje (jo paskutinis, didžiausias LSN
+ * išlieka), kiti intervalo segmentai ištrinami. Likę įrašai ir jų LSN nekeičiami, todėl catch-up ir recovery pasiekia
+ * tą pačią būseną, tik be tarpinių versijų. Dabartinis segmentas neliečiamas, rašymas į WAL neblokuojamas.
+ * @return išmestų įrašų skaičius
+*/
+size_t WAL::CompactSegments(size_t maxSegments) {
+    std::lock_guard<std::mutex> maintenanceLock(this->segmentMaintenanceMutex);
+
+    // Intervalas - iš eilės einantys binary segmentai (tekstinis segmentas nutraukia intervalą).
+    uint64_t current = this->currentSegmentNumber;
+    vector<fs::path> range;
+    for (const auto &segmentPath : this->GetAllSegments()) {
+        uint64_t segmentNumber = SegmentNumber(segmentPath);
+        if (segmentNumber < this->compactedBeforeSegment || segmentNumber >= current || range.size() >= maxSegments) {
             continue;
         }
-
-        string line;
-        while(getline(logFile, line)) {
-            auto record = ParseWalRecord(line);
-            if (record.lsn != 0 && record.lsn > lsn) {
-                recordsToKeep.push_back(record);
+        if (IsTextSegment(segmentPath)) {
+            if (!range.empty()) {
+                break;
             }
+            this->compactedBeforeSegment = segmentNumber + 1;
+            continue;
         }
-
-        logFile.close();
+        range.push_back(segmentPath);
     }
-
-    // Uždarome dabartinį failą, jeigu jis yra atidarytas.
-    if (this->walFile.is_open()) {
-        this->walFile.close();
+    if (range.empty()) {
+        return 0;
     }
+    uint64_t lastSegment = SegmentNumber(range.back());
 
-    // Ištriname visus senus segmentus.
-    for (const auto& segment : segments) {
-        fs::remove(segment);
+    vector<WalRecord> records;
+    for (const auto &segmentPath : range) {
+        ReadSegment(segmentPath, 0, records);
+    }
+    std::unordered_map<string, size_t> latest;
+    latest.reserve(records.size());
+    for (size_t i = 0; i < records.size(); i++) {
+        latest[records[i].key] = i;
+    }
+    size_t dropped = records.size() - latest.size();
+    if (dropped == 0) {
+        this->compactedBeforeSegment = lastSegment + 1;
+        return 0;
     }
 
-    // Atstatome pradinius parametrus.
-    this->currentSegmentNumber = 0;
-    this->currentSegmentSize = 0;
-    this->currentWalPath = this->GetSegmentPath(this->currentSegmentNumber);
-
-    if (!this->OpenWAL()) {
-        return false;
+    // Suspaustas segmentas paruošiamas kitu vardu.
+    string data = SegmentHeaderWithEndMarker();
+    data.resize(WalFormat::SEGMENT_HEADER_SIZE);
+    WalSegmentIndex index;
+    for (size_t i = 0; i < records.size(); i++) {
+        if (latest[records[i].key] == i) {
+            index.Add(records[i].lsn, data.size());
+            EncodeRecord(records[i], data);
+        }
+    }
+    data.append(WalFormat::END_MARKER_SIZE, '\0');
+
+    std::error_code errorCode;
+    fs::path compactedPath = this->walDirectory / (this->name + ".compact");
+    int fd = ::open(compactedPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0 && PWriteAll(fd, data.data(), data.size(), 0) && ::fdatasync(fd) == 0;
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    if (!ok) {
+        fs::remove(compactedPath, errorCode);
+        return 0;
     }
 
-    // Perrašome likusius įrašus į naują WAL.
-    for (const auto& record : recordsToKeep) {
-        if (record.operation == WalOperation::SET) {
-            this->walFile << record.lsn << "|SET|" << record.key << "|" << record.value << "\n";
-        } else {
-            this->walFile << record.lsn << "|DELETE|" << record.key << "\n";
+    // Segmento failas ir jo indeksas pakeičiami kartu (skaitytojai tuo metu neatidaro segmentų).
+    {
+        std::unique_lock<std::shared_mutex> filesLock(this->segmentFilesMutex);
+        fs::rename(compactedPath, range.back(), errorCode);
+        if (errorCode) {
+            fs::remove(compactedPath, errorCode);
+            return 0;
+        }
+        std::lock_guard<std::mutex> indexLock(this->indexMutex);
+        for (size_t i = 0; i + 1 < range.size(); i++) {
+            this->segmentIndexes.erase(SegmentNumber(range[i]));
         }
+        this->segmentIndexes[lastSegment] = std::move(index);
+    }
+    // Ne perdirbami: jau atidarytas skaitytojas turi toliau matyti seną turinį, ne naujus įrašus.
+    for (size_t i = 0; i + 1 < range.size(); i++) {
+        fs::remove(range[i], errorCode);
     }
+    SyncDirectory(this->walDirectory);
 
-    this->walFile.flush();
+    this->compactedBeforeSegment = lastSegment + 1;
+    return dropped;
+}
 
-    // Atnaujiname segmento dydį.
-    if (fs::exists(currentWalPath)) {
-        this->currentSegmentSize = fs::file_size(currentWalPath);
+/**
+ * @brief Segmento numeris iš failo pavadinimo (<name>_<n>.log)
+ * @return segmento numeris arba 0, jei pavadinimas netinkamas
+*/
+uint64_t WAL::SegmentNumber(const fs::path &segmentPath) {
+    string filename = segmentPath.filename().string();
+    size_t underscorePos = filename.rfind('_');
+    size_t dotPos = filename.rfind('.');
+    if (underscorePos == string::npos || dotPos == string::npos || dotPos <= underscorePos) {
+        return 0;
     }
+    return std::stoull(filename.substr(underscorePos + 1, dotPos - underscorePos - 1));
+}
 
-    return true;
+/**
+ * @brief Nuskaito pirmo segmento įrašo LSN
+ * @return LSN arba 0, jei segmentas tuščias
+*/
+uint64_t WAL::ReadFirstLsn(const fs::path &segmentPath) {
+    vector<WalRecord> records;
+    ReadSegment(segmentPath, 0, records, WalFormat::FIRST_RECORD_READ_SIZE);
+    return records.empty() ? 0 : records.front().lsn;
 }
 
 /**
- * @brief Ištrina senus WAL segmentus, kurių numeris mažesnis už nurodytą
+ * @brief Atjungia senus WAL segmentus, kurių numeris mažesnis už nurodytą: jie tik pervadinami į <name>_<n>.recycle,
+ * todėl skaitytojai ir recovery jų nebemato. Nulinimas ir perkėlimas į rezervą - RecycleSegments, kurį kviečiantysis
+ * paleidžia jau be savo lock'ų.
  * @param beforeSegment segmento numerio riba
  * @return true, jei trynimas buvo sėkmingas
 */
 bool WAL::DeleteOldSegments(const uint64_t &beforeSegment) {
+    std::lock_guard<std::mutex> maintenanceLock(this->segmentMaintenanceMutex);
     try {
         auto segments = this->GetAllSegments();
 
@@ -499,11 +1476,20 @@ bool WAL::DeleteOldSegments(const uint64_t &beforeSegment) {
             if (underscorePos != string::npos && dotPos != string::npos) {
                 uint64_t segNum = std::stoull(filename.substr(underscorePos + 1, dotPos - underscorePos - 1));
                 if (segNum < beforeSegment) {
-                    fs::remove(segmentPath);
+                    fs::path detachedPath = segmentPath;
+                    detachedPath.replace_extension(".recycle");
+                    std::error_code errorCode;
+                    fs::rename(segmentPath, detachedPath, errorCode);
+                    if (errorCode) {
+                        fs::remove(segmentPath, errorCode);
+                    }
                 }
             }
         }
 
+        std::lock_guard<std::mutex> indexLock(this->indexMutex);
+        this->segmentIndexes.erase(this->segmentIndexes.begin(), this->segmentIndexes.lower_bound(beforeSegment));
+
         return true;
     } catch (const std::exception &e) {
         return false;
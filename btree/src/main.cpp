@@ -5,9 +5,33 @@
 
 using namespace std;
 
+// Append split with large trailing values: small time ordered values, then MAX_VALUE_LENGTH ones.
+// Every key has to be readable afterwards (the right leaf of an append split must fit the new cell).
+bool AppendSplitTest() {
+    Database AppendSplitDb("AppendSplitTest");
+    char key[16];
+    for (int i = 0; i < 400; i++) {
+        snprintf(key, sizeof(key), "e:%06d", i);
+        AppendSplitDb.Set(key, i < 63 ? string("s") : string(MAX_VALUE_LENGTH, 'a' + i % 26));
+    }
+    for (int i = 0; i < 400; i++) {
+        snprintf(key, sizeof(key), "e:%06d", i);
+        auto cell = AppendSplitDb.Get(key);
+        if (!cell || cell->value != (i < 63 ? string("s") : string(MAX_VALUE_LENGTH, 'a' + i % 26))) {
+            cout << "AppendSplitTest FAILED: " << key << " lost\n";
+            return false;
+        }
+    }
+    cout << "AppendSplitTest OK\n";
+    return true;
+}
+
 
 int main(){
     //WTEST();
+    if (!AppendSplitTest()) {
+        return 1;
+    }
     Database DatabaseSetTest("DataBaseSetTest");
     DatabaseSetTest.Set("x", "x");
     DatabaseSetTest.Set("p", "p");
@@ -16,18 +16,21 @@ using std::memcpy;
 void PageHeader::CoutHeader() {
     cout << "isLeaf: " << isLeaf << "\n"
          << "pageID: " << pageID << "\n"
-         << "parentPageID: " << parentPageID << "\n"
          << "numberOfCells: " << numberOfCells << "\n"
          << "offsetToStartOfFreeSpace: " << offsetToStartOfFreeSpace << "\n"
          << "offsetToEndOfFreeSpace: " << offsetToEndOfFreeSpace << "\n"
-         << "offsetToStartOfSpecialSpace: " << offsetToStartOfSpecialSpace << "\n\n";
+         << "offsetToStartOfSpecialSpace: " << offsetToStartOfSpecialSpace << "\n"
+         << "deadBytes: " << deadBytes << "\n"
+         << "pageLSN: " << pageLSN << "\n\n";
 }
 
 void MetaPageHeader::CoutHeader() {
     cout << "rootPageID: " << rootPageID << "\n"
          << "keyNum: " << keyNumber << "\n"
          << "lastPageID: " << lastPageID << "\n"
-         << "lastSeqeunceNumber: " << lastSequenceNumber << "\n\n";
+         << "lastSeqeunceNumber: " << lastSequenceNumber << "\n"
+         << "checkpointLSN: " << checkpointLSN << "\n"
+         << "lsnBase: " << lsnBase << "\n\n";
 }
 
 // ---------------- Page ----------------
@@ -116,6 +119,16 @@ int16_t BasicPage::FreeSpace() {
     return this->Header()->offsetToEndOfFreeSpace - this->Header()->offsetToStartOfFreeSpace;
 }
 
+/**
+ * @brief Calculates which part of the page's cell area is taken by dead (unreferenced) cell bytes.
+ *
+ * @return double from 0 to 1
+ */
+double BasicPage::DeadSpaceRatio() {
+    uint16_t cellArea = this->Header()->offsetToStartOfSpecialSpace - sizeof(PageHeader);
+    return static_cast<double>(this->Header()->deadBytes) / cellArea;
+}
+
 
 
 // ---------------- MetaPage ----------------
@@ -22,8 +22,9 @@ DbResponse DbClient::send_simple_request(const string& command) {
         return response;
     }
 
+    SocketReader reader(sock);
     string line;
-    if (!recv_line(sock, line)) {
+    if (!reader.ReadLine(line)) {
         net_close(sock);
         response.error = "No response from database";
         return response;
@@ -42,7 +43,7 @@ DbResponse DbClient::send_simple_request(const string& command) {
     // Handle different response types
     if (tokens[0] == "VALUE" && tokens.size() >= 3) {
         // Parse length-prefixed value: "VALUE <value_len> <value>"
-        if (!parse_length_prefixed_value(tokens, 1, sock, response.value)) {
+        if (!parse_length_prefixed_value(tokens, 1, reader, response.value)) {
             net_close(sock);
             response.error = "Failed to parse value";
             return response;
@@ -102,8 +103,9 @@ DbResponse DbClient::getff(const string& key, uint32_t count) {
     }
 
     // Read multiple KEY_VALUE lines until END
+    SocketReader reader(sock);
     string line;
-    while (recv_line(sock, line)) {
+    while (reader.ReadLine(line)) {
         line = trim(line);
 
         if (line == "END") {
@@ -117,67 +119,12 @@ DbResponse DbClient::getff(const string& key, uint32_t count) {
             string key = tokens[1];
             string value;
 
-            // Parse value_len to know how many bytes to read
-            size_t value_len = 0;
-            try {
-                value_len = std::stoull(tokens[2]);
-            } catch (...) {
-                response.error = "Invalid value length in KEY_VALUE";
+            if (!parse_length_prefixed_value(tokens, 2, reader, value)) {
+                response.error = "Invalid value in KEY_VALUE";
                 net_close(sock);
                 return response;
             }
 
-            // Reconstruct value from remaining tokens on this line
-            string reconstructed;
-            for (size_t i = 3; i < tokens.size(); i++) {
-                if (i > 3) {
-                    reconstructed += " ";
-                }
-                reconstructed += tokens[i];
-            }
-
-            // Check if we have the complete value already
-            if (reconstructed.length() == value_len) {
-                value = reconstructed;
-            } else if (reconstructed.length() > value_len) {
-                // Have more than expected, truncate
-                value = reconstructed.substr(0, value_len);
-            } else {
-                // Need to read more bytes from socket
-                // recv_line() stripped the \n, so account for it
-                size_t bytes_needed = value_len - reconstructed.length();
-                value = reconstructed;
-
-                // Add back the newline that recv_line() stripped (if value continues)
-                if (bytes_needed > 0 && reconstructed.length() > 0) {
-                    value += "\n";
-                    bytes_needed -= 1;
-                }
-
-                // Read remaining bytes directly from socket
-                if (bytes_needed > 0) {
-                    std::vector<char> buffer(bytes_needed);
-                    size_t total_read = 0;
-
-                    while (total_read < bytes_needed) {
-                        ssize_t received = recv(sock, buffer.data() + total_read,
-                                               bytes_needed - total_read, 0);
-                        if (received <= 0) {
-                            response.error = "Failed to read complete value";
-                            net_close(sock);
-                            return response;
-                        }
-                        total_read += received;
-                    }
-                    value.append(buffer.data(), bytes_needed);
-                }
-
-                // After reading the value bytes, we need to consume the trailing \n
-                // that the leader added after the value
-                char trailing_newline;
-                recv(sock, &trailing_newline, 1, 0);
-            }
-
             response.results.push_back({key, value});
         } else if (tokens[0] == "ERR") {
             // Error during range query
@@ -221,8 +168,9 @@ DbResponse DbClient::getfb(const string& key, uint32_t count) {
     }
 
     // Read multiple KEY_VALUE lines until END
+    SocketReader reader(sock);
     string line;
-    while (recv_line(sock, line)) {
+    while (reader.ReadLine(line)) {
         line = trim(line);
 
         if (line == "END") {
@@ -237,67 +185,12 @@ DbResponse DbClient::getfb(const string& key, uint32_t count) {
             string key = tokens[1];
             string value;
 
-            // Parse value_len to know how many bytes to read
-            size_t value_len = 0;
-            try {
-                value_len = std::stoull(tokens[2]);
-            } catch (...) {
-                response.error = "Invalid value length in KEY_VALUE";
+            if (!parse_length_prefixed_value(tokens, 2, reader, value)) {
+                response.error = "Invalid value in KEY_VALUE";
                 net_close(sock);
                 return response;
             }
 
-            // Reconstruct value from remaining tokens on this line
-            string reconstructed;
-            for (size_t i = 3; i < tokens.size(); i++) {
-                if (i > 3) {
-                    reconstructed += " ";
-                }
-                reconstructed += tokens[i];
-            }
-
-            // Check if we have the complete value already
-            if (reconstructed.length() == value_len) {
-                value = reconstructed;
-            } else if (reconstructed.length() > value_len) {
-                // Have more than expected, truncate
-                value = reconstructed.substr(0, value_len);
-            } else {
-                // Need to read more bytes from socket
-                // recv_line() stripped the \n, so account for it
-                size_t bytes_needed = value_len - reconstructed.length();
-                value = reconstructed;
-
-                // Add back the newline that recv_line() stripped (if value continues)
-                if (bytes_needed > 0 && reconstructed.length() > 0) {
-                    value += "\n";
-                    bytes_needed -= 1;
-                }
-
-                // Read remaining bytes directly from socket
-                if (bytes_needed > 0) {
-                    std::vector<char> buffer(bytes_needed);
-                    size_t total_read = 0;
-
-                    while (total_read < bytes_needed) {
-                        ssize_t received = recv(sock, buffer.data() + total_read,
-                                               bytes_needed - total_read, 0);
-                        if (received <= 0) {
-                            response.error = "Failed to read complete value";
-                            net_close(sock);
-                            return response;
-                        }
-                        total_read += received;
-                    }
-                    value.append(buffer.data(), bytes_needed);
-                }
-
-                // After reading the value bytes, we need to consume the trailing \n
-                // that the leader added after the value
-                char trailing_newline;
-                recv(sock, &trailing_newline, 1, 0);
-            }
-
             response.results.push_back({key, value});
         } else if (tokens[0] == "ERR") {
             // Error during range query
@@ -336,8 +229,9 @@ DbResponse DbClient::getKeysPrefix(const string& prefix) {
     string command = "GETKEYS " + prefix + "\n";
     send_all(sock, command);
 
+    SocketReader reader(sock);
     string line;
-    while (recv_line(sock, line)) {
+    while (reader.ReadLine(line)) {
         line = trim(line);
         if (line == "END") {
             response.success = true;
@@ -370,8 +264,9 @@ DbResponse DbClient::getKeysPaging(uint32_t pageSize, uint32_t pageNum) {
     string command = "GETKEYSPAGING " + std::to_string(pageSize) + " " + std::to_string(pageNum) + "\n";
     send_all(sock, command);
 
+    SocketReader reader(sock);
     string line;
-    while (recv_line(sock, line)) {
+    while (reader.ReadLine(line)) {
         line = trim(line);
         if (line == "END") {
             response.success = true;
@@ -404,8 +299,9 @@ DbResponse DbClient::optimize() {
 
     send_all(sock, "OPTIMIZE\n");
 
+    SocketReader reader(sock);
     string line;
-    if (!recv_line(sock, line)) {
+    if (!reader.ReadLine(line)) {
         net_close(sock);
         response.error = "No response from database";
         return response;